@@ -0,0 +1,26 @@
+#ifndef TINYFS_ERRNO_H
+#define TINYFS_ERRNO_H
+
+// error codes returned by the tfs_* / fs_* calls and by libDisk. every failure is
+// one of these negative values, so callers that only test for < 0 keep working
+typedef enum {
+    TFS_OK = 0,
+    TFS_EINVAL = -1,       // bad argument (size, buffer, block number, cache configuration)
+    TFS_ENOTMOUNTED = -2,  // no file system is mounted
+    TFS_EMOUNTED = -3,     // a file system is already mounted
+    TFS_EBADFD = -4,       // descriptor is not open, or its file was deleted
+    TFS_ENAME = -5,        // file name missing or empty
+    TFS_ENOSPC = -6,       // not enough free blocks
+    TFS_ENOMEM = -7,       // out of memory
+    TFS_EIO = -8,          // a block or the disk file could not be read or written
+    TFS_EOPEN = -9,        // disk file could not be opened
+    TFS_EFORMAT = -10,     // not a TinyFS disk, or its superblock does not match the file
+    TFS_EVERSION = -11,    // disk uses a newer format or another block size
+    TFS_ECORRUPT = -12,    // directory or extent list is damaged beyond repair
+    TFS_EEOF = -13,        // tfs_readByte at the end of the file
+    TFS_ECHECKSUM = -14    // a block read back does not match the checksum recorded when it was written
+} TinyFSError;
+
+const char *tfs_strerror(int code); // short description of code, for messages
+
+#endif
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE // syscall and MAP_POPULATE under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include "asyncDisk.h"
+#include "tinyLog.h"
+#include "stats.h"
+
+// io_uring is used through its raw syscalls, so no liburing is needed
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+typedef struct {
+    AsyncBatch *batch; // batch the request belongs to, NULL while the slot is free
+    int write;
+    int startBlock;
+    int count;
+    void *buf;
+    struct iovec iov;  // what io_uring reads into / writes from
+    unsigned long long submitted; // statsNow() at submit
+    int next;          // free list, or the worker queue
+} Request;
+
+struct AsyncDisk {
+    int disk;
+    int engine;
+    int depth;            // request slots
+    Request *requests;
+    int freeHead;         // free slots (-1 = none)
+    int queueHead;        // worker engine: submitted requests no worker has picked up yet
+    int queueTail;
+    int inFlight;         // slots in use
+    int finished;         // requests finished since the last pollDisk
+    int closing;
+    pthread_mutex_t lock; // every field above, and the batches of the requests in flight
+    pthread_cond_t done;  // a request finished
+    pthread_cond_t work;  // worker engine: the queue is not empty, or the disk is closing
+    pthread_t workers[ASYNC_WORKERS];
+    int nWorkers;
+#ifdef HAVE_IO_URING
+    int ringFd;
+    int reaping;          // a thread is in io_uring_enter waiting for completions
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+#endif
+};
+
+static int runRequest(AsyncDisk *aio, Request *r) {
+    return r->write ? writeBlocks(aio->disk, r->startBlock, r->count, r->buf)
+                    : readBlocks(aio->disk, r->startBlock, r->count, r->buf);
+}
+
+// hand slot back and tell its batch, called with the lock held
+static void finishRequest(AsyncDisk *aio, int slot, int result) {
+    Request *r = &aio->requests[slot];
+    if (result < 0 && r->batch->result == 0) {
+        r->batch->result = result;
+    }
+    r->batch->pending--;
+    r->batch = NULL;
+    r->next = aio->freeHead;
+    aio->freeHead = slot;
+    aio->inFlight--;
+    aio->finished++;
+    pthread_cond_broadcast(&aio->done);
+}
+
+#ifdef HAVE_IO_URING
+static int ringSetup(AsyncDisk *aio) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    aio->ringFd = (int)syscall(__NR_io_uring_setup, aio->depth, &p);
+    if (aio->ringFd < 0) {
+        return -1; // no io_uring in this kernel (or it is not allowed)
+    }
+    aio->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    aio->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0; // both rings in one mapping
+    if (single && aio->cqRingSize > aio->sqRingSize) {
+        aio->sqRingSize = aio->cqRingSize;
+    }
+    aio->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    aio->sqRing = mmap(NULL, aio->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ringFd, IORING_OFF_SQ_RING);
+    aio->cqRing = single ? aio->sqRing
+                         : mmap(NULL, aio->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ringFd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, aio->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ringFd, IORING_OFF_SQES);
+    if (aio->sqRing == MAP_FAILED || aio->cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, aio->sqesSize);
+        }
+        if (!single && aio->cqRing != MAP_FAILED) {
+            munmap(aio->cqRing, aio->cqRingSize);
+        }
+        if (aio->sqRing != MAP_FAILED) {
+            munmap(aio->sqRing, aio->sqRingSize);
+        }
+        close(aio->ringFd);
+        return -1;
+    }
+    char *sq = aio->sqRing, *cq = aio->cqRing;
+    aio->sqHead = (unsigned *)(sq + p.sq_off.head);
+    aio->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    aio->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    aio->sqArray = (unsigned *)(sq + p.sq_off.array);
+    aio->sqes = sqes;
+    aio->cqHead = (unsigned *)(cq + p.cq_off.head);
+    aio->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    aio->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void ringTeardown(AsyncDisk *aio) {
+    munmap(aio->sqes, aio->sqesSize);
+    if (aio->cqRing != aio->sqRing) {
+        munmap(aio->cqRing, aio->cqRingSize);
+    }
+    munmap(aio->sqRing, aio->sqRingSize);
+    close(aio->ringFd);
+}
+
+// queue slot on the submission ring, called with the lock held. the ring has at
+// least depth entries, so there is always room for every slot in use
+static void ringPush(AsyncDisk *aio, int slot) {
+    Request *r = &aio->requests[slot];
+    r->iov.iov_base = r->buf;
+    r->iov.iov_len = (size_t)r->count * BLOCKSIZE;
+
+    unsigned tail = *aio->sqTail;
+    unsigned index = tail & *aio->sqMask;
+    struct io_uring_sqe *sqe = &aio->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = r->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = aio->disk;
+    sqe->addr = (unsigned long)&r->iov;
+    sqe->len = 1;
+    sqe->off = (unsigned long long)r->startBlock * BLOCKSIZE;
+    sqe->user_data = slot;
+    aio->sqArray[index] = index;
+    __atomic_store_n(aio->sqTail, tail + 1, __ATOMIC_RELEASE); // the kernel sees the entry only now
+}
+
+// hand every queued entry to the kernel, and with wait also block for a completion
+static void ringEnter(AsyncDisk *aio, int wait) {
+    unsigned toSubmit = __atomic_load_n(aio->sqTail, __ATOMIC_ACQUIRE) - __atomic_load_n(aio->sqHead, __ATOMIC_ACQUIRE);
+    while (syscall(__NR_io_uring_enter, aio->ringFd, toSubmit, wait ? 1 : 0,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0 && errno == EINTR) {
+    }
+}
+
+// finish every request the kernel has completed, called with the lock held
+static void reapCompletions(AsyncDisk *aio) {
+    unsigned head = *aio->cqHead;
+    unsigned tail = __atomic_load_n(aio->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &aio->cqes[head & *aio->cqMask];
+        int slot = (int)cqe->user_data;
+        int res = cqe->res;
+        head++;
+        __atomic_store_n(aio->cqHead, head, __ATOMIC_RELEASE);
+
+        Request *r = &aio->requests[slot];
+        int result = 0;
+        if (res != (int)r->iov.iov_len) {
+            // error or short transfer: redo it synchronously, libDisk retries short transfers
+            logError("Async %s of blocks %d-%d returned %d, retrying.\n", r->write ? "write" : "read",
+                     r->startBlock, r->startBlock + r->count - 1, res);
+            result = runRequest(aio, r);
+        } else {
+            StatsSpan span;
+            statsBegin(&span);
+            span.start = r->submitted; // charged from submit to completion
+            statsEnd(&span, r->write ? STAT_DISK_WRITE : STAT_DISK_READ, r->startBlock, 0, (long long)r->count * BLOCKSIZE, r->count);
+        }
+        finishRequest(aio, slot, result);
+    }
+}
+#endif
+
+// block until some request finishes, called with the lock held. with io_uring the
+// first thread to get here collects completions from the kernel for everyone
+static void waitProgress(AsyncDisk *aio) {
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNC_ENGINE_URING && !aio->reaping) {
+        aio->reaping = 1;
+        pthread_mutex_unlock(&aio->lock);
+        ringEnter(aio, 1);
+        pthread_mutex_lock(&aio->lock);
+        aio->reaping = 0;
+        reapCompletions(aio);
+        pthread_cond_broadcast(&aio->done); // let the next waiter take over reaping
+        return;
+    }
+#endif
+    pthread_cond_wait(&aio->done, &aio->lock);
+}
+
+static void *workerMain(void *arg) {
+    AsyncDisk *aio = arg;
+    pthread_mutex_lock(&aio->lock);
+    for (;;) {
+        while (aio->queueHead == -1 && !aio->closing) {
+            pthread_cond_wait(&aio->work, &aio->lock);
+        }
+        if (aio->queueHead == -1) {
+            break; // closing and nothing left to do
+        }
+        int slot = aio->queueHead;
+        aio->queueHead = aio->requests[slot].next;
+        if (aio->queueHead == -1) {
+            aio->queueTail = -1;
+        }
+        pthread_mutex_unlock(&aio->lock);
+        int result = runRequest(aio, &aio->requests[slot]);
+        pthread_mutex_lock(&aio->lock);
+        finishRequest(aio, slot, result);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+AsyncDisk *asyncOpen(int disk, int depth, int engine) {
+    if (depth <= 0) {
+        depth = ASYNC_DEPTH;
+    }
+    AsyncDisk *aio = calloc(1, sizeof(AsyncDisk));
+    if (aio == NULL) {
+        return NULL;
+    }
+    aio->requests = malloc(sizeof(Request) * depth);
+    if (aio->requests == NULL) {
+        free(aio);
+        return NULL;
+    }
+    aio->disk = disk;
+    aio->depth = depth;
+    for (int i = 0; i < depth; i++) {
+        aio->requests[i].batch = NULL;
+        aio->requests[i].next = i + 1 < depth ? i + 1 : -1;
+    }
+    aio->freeHead = 0;
+    aio->queueHead = -1;
+    aio->queueTail = -1;
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->done, NULL);
+    pthread_cond_init(&aio->work, NULL);
+
+    if (mapBlock(disk, 0) != NULL) {
+        aio->engine = ASYNC_ENGINE_SYNC; // a copy out of the mapping gains nothing from a queue
+        return aio;
+    }
+#ifdef HAVE_IO_URING
+    if ((engine == ASYNC_ENGINE_AUTO || engine == ASYNC_ENGINE_URING) && ringSetup(aio) == 0) {
+        aio->engine = ASYNC_ENGINE_URING;
+        return aio;
+    }
+#endif
+    if (engine == ASYNC_ENGINE_URING) {
+        asyncClose(aio); // asked for io_uring only
+        return NULL;
+    }
+    aio->engine = ASYNC_ENGINE_THREADS;
+    while (aio->nWorkers < ASYNC_WORKERS &&
+           pthread_create(&aio->workers[aio->nWorkers], NULL, workerMain, aio) == 0) {
+        aio->nWorkers++;
+    }
+    if (aio->nWorkers == 0) {
+        aio->engine = ASYNC_ENGINE_SYNC; // no threads either, requests run as they are submitted
+    }
+    return aio;
+}
+
+void asyncClose(AsyncDisk *aio) {
+    if (aio == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&aio->lock);
+    while (aio->inFlight > 0) {
+        waitProgress(aio);
+    }
+    aio->closing = 1;
+    pthread_cond_broadcast(&aio->work);
+    pthread_mutex_unlock(&aio->lock);
+    for (int i = 0; i < aio->nWorkers; i++) {
+        pthread_join(aio->workers[i], NULL);
+    }
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNC_ENGINE_URING) {
+        ringTeardown(aio);
+    }
+#endif
+    pthread_mutex_destroy(&aio->lock);
+    pthread_cond_destroy(&aio->done);
+    pthread_cond_destroy(&aio->work);
+    free(aio->requests);
+    free(aio);
+}
+
+int asyncEngine(AsyncDisk *aio) {
+    return aio->engine;
+}
+
+void batchInit(AsyncBatch *batch) {
+    batch->pending = 0;
+    batch->result = 0;
+}
+
+static int submit(AsyncDisk *aio, AsyncBatch *batch, int write, int startBlock, int count, void *buf) {
+    if (startBlock < 0 || count < 0 || batch == NULL) {
+        return TFS_EINVAL;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    if (aio->engine == ASYNC_ENGINE_SYNC) {
+        Request r = {0};
+        r.batch = batch;
+        r.write = write;
+        r.startBlock = startBlock;
+        r.count = count;
+        r.buf = buf;
+        int result = runRequest(aio, &r);
+        if (result < 0 && batch->result == 0) {
+            batch->result = result;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&aio->lock);
+    while (aio->freeHead == -1) {
+        waitProgress(aio); // every slot is in flight, wait for one to come back
+    }
+    int slot = aio->freeHead;
+    Request *r = &aio->requests[slot];
+    aio->freeHead = r->next;
+    r->batch = batch;
+    r->write = write;
+    r->startBlock = startBlock;
+    r->count = count;
+    r->buf = buf;
+    r->submitted = statsNow();
+    r->next = -1;
+    batch->pending++;
+    aio->inFlight++;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNC_ENGINE_URING) {
+        ringPush(aio, slot);
+        pthread_mutex_unlock(&aio->lock);
+        ringEnter(aio, 0);
+        return 0;
+    }
+#endif
+    if (aio->queueTail == -1) {
+        aio->queueHead = slot;
+    } else {
+        aio->requests[aio->queueTail].next = slot;
+    }
+    aio->queueTail = slot;
+    pthread_cond_signal(&aio->work);
+    pthread_mutex_unlock(&aio->lock);
+    return 0;
+}
+
+int submitRead(AsyncDisk *aio, AsyncBatch *batch, int startBlock, int count, void *buf) {
+    return submit(aio, batch, 0, startBlock, count, buf);
+}
+
+int submitWrite(AsyncDisk *aio, AsyncBatch *batch, int startBlock, int count, void *buf) {
+    return submit(aio, batch, 1, startBlock, count, buf);
+}
+
+int pollDisk(AsyncDisk *aio) {
+    if (aio->engine == ASYNC_ENGINE_SYNC) {
+        return 0; // nothing is ever in flight
+    }
+    pthread_mutex_lock(&aio->lock);
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNC_ENGINE_URING && !aio->reaping) {
+        reapCompletions(aio);
+    }
+#endif
+    int finished = aio->finished;
+    aio->finished = 0;
+    pthread_mutex_unlock(&aio->lock);
+    return finished;
+}
+
+int waitBatch(AsyncDisk *aio, AsyncBatch *batch) {
+    if (aio->engine != ASYNC_ENGINE_SYNC) {
+        pthread_mutex_lock(&aio->lock);
+        while (batch->pending > 0) {
+            waitProgress(aio);
+        }
+        pthread_mutex_unlock(&aio->lock);
+    }
+    return batch->result;
+}
@@ -0,0 +1,37 @@
+#ifndef ASYNCDISK_H
+#define ASYNCDISK_H
+
+#include "libDisk.h"
+
+// engines behind an AsyncDisk
+#define ASYNC_ENGINE_AUTO 0    // io_uring when the kernel has it, worker threads otherwise
+#define ASYNC_ENGINE_URING 1
+#define ASYNC_ENGINE_THREADS 2
+#define ASYNC_ENGINE_SYNC 3    // mapped disks: a request is a memcpy, done before submit returns
+
+#define ASYNC_DEPTH 64  // requests an AsyncDisk keeps in flight by default
+#define ASYNC_WORKERS 4 // threads of the fallback engine
+
+// asynchronous block I/O on one libDisk disk. requests are grouped in batches owned
+// by the caller: submitRead / submitWrite add a request to a batch and return at
+// once, waitBatch returns when every request of the batch has finished. any number
+// of threads can share one AsyncDisk, each waiting only for its own batches.
+// a request's buffer must stay untouched until its batch is done.
+typedef struct AsyncDisk AsyncDisk;
+
+typedef struct {
+    int pending; // requests submitted but not finished
+    int result;  // 0, or the error code of the first request that failed
+} AsyncBatch;
+
+AsyncDisk *asyncOpen(int disk, int depth, int engine); // NULL on failure
+void asyncClose(AsyncDisk *aio); // waits for everything still in flight
+int asyncEngine(AsyncDisk *aio); // ASYNC_ENGINE_* actually in use
+
+void batchInit(AsyncBatch *batch);
+int submitRead(AsyncDisk *aio, AsyncBatch *batch, int startBlock, int count, void *buf);
+int submitWrite(AsyncDisk *aio, AsyncBatch *batch, int startBlock, int count, void *buf);
+int pollDisk(AsyncDisk *aio); // collect finished requests without blocking, returns how many
+int waitBatch(AsyncDisk *aio, AsyncBatch *batch); // returns the batch result once it is done
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap.h"
+
+#define WORD_BITS 64
+
+int bitmapInit(Bitmap *map, int nBits) {
+    int nWords = (nBits + WORD_BITS - 1) / WORD_BITS;
+    map->words = calloc(nWords > 0 ? nWords : 1, sizeof(unsigned long long));
+    if (map->words == NULL) {
+        return -1; // failure (out of memory)
+    }
+    map->held = NULL;
+    map->nBits = nBits;
+    map->nFree = nBits;
+    map->nHeld = 0;
+    bitmapClean(map);
+    // bits past the end of the last word are permanently in use so searches never return them
+    if (nBits % WORD_BITS != 0) {
+        map->words[nWords - 1] = ~0ULL << (nBits % WORD_BITS);
+    }
+    return 0;
+}
+
+void bitmapDestroy(Bitmap *map) {
+    free(map->words);
+    free(map->held);
+    map->words = NULL;
+    map->held = NULL;
+    map->nBits = 0;
+    map->nFree = 0;
+    map->nHeld = 0;
+}
+
+void bitmapClean(Bitmap *map) {
+    map->dirty = 0;
+    map->dirtyLow = map->nBits;
+    map->dirtyHigh = -1;
+}
+
+int bitmapHold(Bitmap *map) {
+    if (map->held == NULL) {
+        int nWords = (map->nBits + WORD_BITS - 1) / WORD_BITS;
+        map->held = calloc(nWords > 0 ? nWords : 1, sizeof(unsigned long long));
+        if (map->held == NULL) {
+            return -1; // failure (out of memory)
+        }
+    }
+    return 0;
+}
+
+void bitmapRelease(Bitmap *map) {
+    if (map->held == NULL || map->nHeld == 0) {
+        return;
+    }
+    int nWords = (map->nBits + WORD_BITS - 1) / WORD_BITS;
+    for (int w = 0; w < nWords; w++) {
+        map->words[w] &= ~map->held[w];
+        map->held[w] = 0;
+    }
+    map->nFree += map->nHeld;
+    map->nHeld = 0;
+}
+
+int bitmapTest(Bitmap *map, int bit) {
+    return (map->words[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+// set or clear [start, start + count), whole words at a time where possible
+static void bitmapUpdate(Bitmap *map, int start, int count, int set) {
+    map->dirty = 1;
+    if (start < map->dirtyLow) {
+        map->dirtyLow = start;
+    }
+    if (start + count - 1 > map->dirtyHigh) {
+        map->dirtyHigh = start + count - 1;
+    }
+    int bit = start;
+    int end = start + count;
+    while (bit < end) {
+        int w = bit / WORD_BITS;
+        int lo = bit % WORD_BITS;
+        int n = WORD_BITS - lo < end - bit ? WORD_BITS - lo : end - bit;
+        unsigned long long mask = (n == WORD_BITS ? ~0ULL : ((1ULL << n) - 1)) << lo;
+        int changed = __builtin_popcountll(set ? ~map->words[w] & mask : map->words[w] & mask);
+        if (set) {
+            map->words[w] |= mask;
+            map->nFree -= changed;
+        } else if (map->held != NULL) {
+            mask &= map->words[w] & ~map->held[w]; // in use and not held yet
+            map->held[w] |= mask;
+            map->nHeld += __builtin_popcountll(mask);
+        } else {
+            map->words[w] &= ~mask;
+            map->nFree += changed;
+        }
+        bit += n;
+    }
+}
+
+void bitmapSet(Bitmap *map, int start, int count) {
+    bitmapUpdate(map, start, count, 1);
+}
+
+void bitmapClear(Bitmap *map, int start, int count) {
+    bitmapUpdate(map, start, count, 0);
+}
+
+// first clear bit at or after bit, nBits if there is none
+static int nextClear(Bitmap *map, int bit) {
+    if (bit >= map->nBits) {
+        return map->nBits;
+    }
+    int w = bit / WORD_BITS;
+    unsigned long long avail = ~map->words[w] & (~0ULL << (bit % WORD_BITS));
+    int nWords = (map->nBits + WORD_BITS - 1) / WORD_BITS;
+    while (avail == 0) {
+        if (++w >= nWords) {
+            return map->nBits;
+        }
+        avail = ~map->words[w];
+    }
+    int found = w * WORD_BITS + __builtin_ctzll(avail);
+    return found < map->nBits ? found : map->nBits;
+}
+
+// first set bit at or after bit, stopping at limit
+static int nextSet(Bitmap *map, int bit, int limit) {
+    if (bit >= limit) {
+        return limit;
+    }
+    int w = bit / WORD_BITS;
+    unsigned long long used = map->words[w] & (~0ULL << (bit % WORD_BITS));
+    while (used == 0) {
+        if ((++w) * WORD_BITS >= limit) {
+            return limit;
+        }
+        used = map->words[w];
+    }
+    int found = w * WORD_BITS + __builtin_ctzll(used);
+    return found < limit ? found : limit;
+}
+
+int bitmapRangeFree(Bitmap *map, int start, int count) {
+    if (start < 0 || count < 0 || start + count > map->nBits) {
+        return 0;
+    }
+    return nextSet(map, start, start + count) == start + count;
+}
+
+int bitmapFindRun(Bitmap *map, int count, int from) {
+    if (count <= 0 || count > map->nFree) {
+        return -1;
+    }
+    int bit = from;
+    while (1) {
+        int start = nextClear(map, bit);
+        if (start + count > map->nBits) {
+            return -1; // no run long enough
+        }
+        int end = nextSet(map, start, start + count);
+        if (end == start + count) {
+            return start;
+        }
+        bit = end; // run too short, continue past the used bit that ended it
+    }
+}
+
+int bitmapFindFree(Bitmap *map, int from, int maxCount, int *count) {
+    int start = nextClear(map, from);
+    if (start >= map->nBits || maxCount <= 0) {
+        return -1; // no clear bit left
+    }
+    int limit = start + maxCount < map->nBits ? start + maxCount : map->nBits;
+    *count = nextSet(map, start, limit) - start;
+    return start;
+}
+
+void bitmapLoad(Bitmap *map, const unsigned char *bytes, int firstBit, int nBits) {
+    for (int i = 0; i < nBits; i++) {
+        int bit = firstBit + i;
+        if (bit >= map->nBits) {
+            break;
+        }
+        if ((bytes[i / 8] >> (i % 8)) & 1) {
+            bitmapSet(map, bit, 1);
+        } else {
+            bitmapClear(map, bit, 1);
+        }
+    }
+}
+
+void bitmapStore(Bitmap *map, unsigned char *bytes, int firstBit, int nBits) {
+    memset(bytes, 0, (nBits + 7) / 8);
+    for (int i = 0; i < nBits; i++) {
+        int bit = firstBit + i;
+        if (bit >= map->nBits) {
+            break;
+        }
+        int held = map->held != NULL && ((map->held[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1);
+        if (bitmapTest(map, bit) && !held) {
+            bytes[i / 8] |= 1 << (i % 8);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+// in-memory allocation bitmap, one bit per block (1 = in use).
+// searches go a 64-bit word at a time and use __builtin_ctzll to find bits.
+typedef struct {
+    unsigned long long *words;
+    unsigned long long *held; // while holding: bits cleared since, still set in words (NULL otherwise)
+    int nBits;  // number of blocks tracked
+    int nFree;  // number of clear bits
+    int nHeld;  // number of held bits
+    int dirty;  // set on every change, cleared by the owner once the bitmap is stored
+    int dirtyLow, dirtyHigh; // bits changed since bitmapClean lie in [dirtyLow, dirtyHigh]
+} Bitmap;
+
+int bitmapInit(Bitmap *map, int nBits); // all bits start clear
+void bitmapDestroy(Bitmap *map);
+void bitmapClean(Bitmap *map); // the bitmap is stored: clear dirty and the changed range
+
+// holding: a cleared bit is stored as free but stays in use in memory, so it is not
+// handed out again until bitmapRelease. the journal keeps freed blocks from being reused
+// while a transaction that may still be replayed has an old image of them
+int bitmapHold(Bitmap *map);
+void bitmapRelease(Bitmap *map); // clear every held bit for real, holding goes on
+
+int bitmapTest(Bitmap *map, int bit);
+void bitmapSet(Bitmap *map, int start, int count);   // mark [start, start + count) in use
+void bitmapClear(Bitmap *map, int start, int count); // mark [start, start + count) free
+int bitmapRangeFree(Bitmap *map, int start, int count); // 1 if every bit in the range is clear
+int bitmapFindRun(Bitmap *map, int count, int from); // first run of count clear bits at or after from, -1 if none
+int bitmapFindFree(Bitmap *map, int from, int maxCount, int *count); // first clear bit at or after from, *count = clear bits from there (at most maxCount)
+
+// on-disk form: byte i holds bits 8i..8i+7, least significant bit first
+void bitmapLoad(Bitmap *map, const unsigned char *bytes, int firstBit, int nBits);
+void bitmapStore(Bitmap *map, unsigned char *bytes, int firstBit, int nBits);
+
+#endif
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "libDisk.h"
+#include "blockCache.h"
+#include "stats.h"
+
+typedef struct {
+    int bNum;       // disk block held in this slot (-1 when the slot is empty)
+    int dirty;      // 1 if the cached copy has not been written back yet
+    int referenced; // reference bit for CLOCK
+    int prev;       // LRU list, towards the most recently used slot
+    int next;       // LRU list, towards the least recently used slot
+    int hashNext;   // next slot in the same hash bucket
+} CacheEntry;
+
+struct BlockCache {
+    int disk;           // libDisk disk number the cache reads from / writes to
+    int policy;         // CACHE_POLICY_LRU or CACHE_POLICY_CLOCK
+    int nSlots;         // number of blocks the cache can hold (grows while holding dirty blocks)
+    int passThrough;    // created with no slots: every call goes straight to libDisk, fixed for the cache's life
+    int nBuckets;       // size of the hash table (power of 2)
+    int *buckets;       // bNum -> first slot in the bucket (-1 if empty)
+    CacheEntry *entries;
+    char *data;         // nSlots * BLOCKSIZE bytes of block data
+    int lruHead;        // most recently used slot
+    int lruTail;        // least recently used slot
+    int clockHand;      // next slot CLOCK looks at
+    int slotsUsed;      // slots handed out so far (free slots are used first)
+    int holdDirty;      // dirty blocks are never evicted, the cache grows instead
+    pthread_mutex_t lock; // held for every lookup and slot change, bulk data I/O runs outside it
+};
+
+static int hashBucket(BlockCache *cache, int bNum) {
+    return (unsigned int)bNum * 2654435761u & (cache->nBuckets - 1);
+}
+
+static char *slotData(BlockCache *cache, int slot) {
+    return cache->data + (size_t)slot * BLOCKSIZE;
+}
+
+static int lookupSlot(BlockCache *cache, int bNum) {
+    for (int s = cache->buckets[hashBucket(cache, bNum)]; s != -1; s = cache->entries[s].hashNext) {
+        if (cache->entries[s].bNum == bNum) {
+            return s;
+        }
+    }
+    return -1; // block is not resident
+}
+
+static void hashInsert(BlockCache *cache, int slot) {
+    int b = hashBucket(cache, cache->entries[slot].bNum);
+    cache->entries[slot].hashNext = cache->buckets[b];
+    cache->buckets[b] = slot;
+}
+
+static void hashRemove(BlockCache *cache, int slot) {
+    int *link = &cache->buckets[hashBucket(cache, cache->entries[slot].bNum)];
+    while (*link != slot) {
+        link = &cache->entries[*link].hashNext;
+    }
+    *link = cache->entries[slot].hashNext;
+}
+
+static void lruUnlink(BlockCache *cache, int slot) {
+    CacheEntry *e = &cache->entries[slot];
+    if (e->prev != -1) {
+        cache->entries[e->prev].next = e->next;
+    } else {
+        cache->lruHead = e->next;
+    }
+    if (e->next != -1) {
+        cache->entries[e->next].prev = e->prev;
+    } else {
+        cache->lruTail = e->prev;
+    }
+}
+
+static void lruPushFront(BlockCache *cache, int slot) {
+    CacheEntry *e = &cache->entries[slot];
+    e->prev = -1;
+    e->next = cache->lruHead;
+    if (cache->lruHead != -1) {
+        cache->entries[cache->lruHead].prev = slot;
+    }
+    cache->lruHead = slot;
+    if (cache->lruTail == -1) {
+        cache->lruTail = slot;
+    }
+}
+
+// record a use of slot for the replacement policy
+static void touchSlot(BlockCache *cache, int slot) {
+    if (cache->policy == CACHE_POLICY_CLOCK) {
+        cache->entries[slot].referenced = 1;
+    } else if (cache->lruHead != slot) {
+        lruUnlink(cache, slot);
+        lruPushFront(cache, slot);
+    }
+}
+
+// double the number of slots, when every slot holds a dirty block that must stay
+static int growCache(BlockCache *cache) {
+    int nSlots = cache->nSlots * 2;
+    CacheEntry *entries = realloc(cache->entries, sizeof(CacheEntry) * nSlots);
+    if (entries == NULL) {
+        return -1; // failure (out of memory)
+    }
+    cache->entries = entries;
+    char *data = realloc(cache->data, (size_t)BLOCKSIZE * nSlots);
+    if (data == NULL) {
+        return -1; // failure (out of memory), the larger entry array is simply not used yet
+    }
+    cache->data = data;
+    for (int i = cache->nSlots; i < nSlots; i++) {
+        cache->entries[i].bNum = -1;
+        cache->entries[i].dirty = 0;
+        cache->entries[i].referenced = 0;
+        cache->entries[i].prev = -1;
+        cache->entries[i].next = -1;
+        cache->entries[i].hashNext = -1;
+    }
+    cache->nSlots = nSlots;
+
+    // keep at least two buckets per slot
+    if (cache->nBuckets < nSlots * 2) {
+        int *buckets = realloc(cache->buckets, sizeof(int) * nSlots * 2);
+        if (buckets != NULL) {
+            cache->buckets = buckets;
+            cache->nBuckets = nSlots * 2;
+            for (int i = 0; i < cache->nBuckets; i++) {
+                cache->buckets[i] = -1;
+            }
+            for (int slot = 0; slot < cache->slotsUsed; slot++) {
+                if (cache->entries[slot].bNum != -1) {
+                    hashInsert(cache, slot);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// slot to reuse, -1 if none could be found or made
+static int pickVictim(BlockCache *cache) {
+    if (cache->slotsUsed == cache->nSlots && cache->holdDirty) {
+        // a full cache grows once no slot is left that may be evicted
+        int evictable = cache->policy == CACHE_POLICY_LRU ? cache->lruTail : 0;
+        if (cache->policy == CACHE_POLICY_LRU) {
+            while (evictable != -1 && cache->entries[evictable].dirty) {
+                evictable = cache->entries[evictable].prev;
+            }
+        } else {
+            while (evictable < cache->nSlots && cache->entries[evictable].dirty) {
+                evictable++;
+            }
+            evictable = evictable < cache->nSlots ? evictable : -1;
+        }
+        if (evictable == -1 && growCache(cache) != 0) {
+            return -1; // failure (no slot can be evicted and the cache cannot grow)
+        }
+        if (evictable != -1 && cache->policy == CACHE_POLICY_LRU) {
+            return evictable;
+        }
+    }
+    if (cache->slotsUsed < cache->nSlots) {
+        int slot = cache->slotsUsed++;
+        if (cache->policy == CACHE_POLICY_LRU) {
+            lruPushFront(cache, slot);
+        }
+        return slot;
+    }
+    if (cache->policy == CACHE_POLICY_LRU) {
+        return cache->lruTail;
+    }
+    // CLOCK: give every referenced slot a second chance, held dirty slots are passed over
+    while (cache->entries[cache->clockHand].referenced ||
+           (cache->holdDirty && cache->entries[cache->clockHand].dirty)) {
+        cache->entries[cache->clockHand].referenced = 0;
+        cache->clockHand = (cache->clockHand + 1) % cache->nSlots;
+    }
+    int slot = cache->clockHand;
+    cache->clockHand = (cache->clockHand + 1) % cache->nSlots;
+    return slot;
+}
+
+// write a dirty slot back to disk and drop it from the hash table
+static int evictSlot(BlockCache *cache, int slot) {
+    CacheEntry *e = &cache->entries[slot];
+    if (e->bNum == -1) {
+        return 0; // nothing cached here
+    }
+    if (e->dirty) {
+        if (writeBlock(cache->disk, e->bNum, slotData(cache, slot)) != 0) {
+            return -1; // failure (unable to write back dirty block)
+        }
+        e->dirty = 0;
+    }
+    hashRemove(cache, slot);
+    e->bNum = -1;
+    return 0;
+}
+
+// find the slot caching bNum, bringing the block in from disk if load is set
+static int getSlot(BlockCache *cache, int bNum, int load) {
+    int slot = lookupSlot(cache, bNum);
+    if (slot != -1) {
+        statsCacheAccess(1, 1, 0);
+        touchSlot(cache, slot);
+        return slot;
+    }
+    statsCacheAccess(1, 0, 1);
+
+    slot = pickVictim(cache);
+    if (slot == -1 || evictSlot(cache, slot) != 0) {
+        return -1; // failure (victim could not be written back)
+    }
+    if (load && readBlock(cache->disk, bNum, slotData(cache, slot)) != 0) {
+        return -1; // failure (unable to read block), slot stays empty
+    }
+    cache->entries[slot].bNum = bNum;
+    cache->entries[slot].dirty = 0;
+    hashInsert(cache, slot);
+    touchSlot(cache, slot);
+    return slot;
+}
+
+BlockCache *cacheCreate(int disk, int nBlocks, int policy) {
+    if (nBlocks < 0 || (policy != CACHE_POLICY_LRU && policy != CACHE_POLICY_CLOCK)) {
+        return NULL; // failure (bad configuration)
+    }
+
+    BlockCache *cache = calloc(1, sizeof(BlockCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->disk = disk;
+    cache->policy = policy;
+    cache->nSlots = nBlocks;
+    cache->passThrough = nBlocks == 0;
+    cache->nBuckets = 1;
+    while (cache->nBuckets < nBlocks * 2) {
+        cache->nBuckets <<= 1;
+    }
+    cache->lruHead = -1;
+    cache->lruTail = -1;
+
+    cache->buckets = malloc(sizeof(int) * cache->nBuckets);
+    cache->entries = malloc(sizeof(CacheEntry) * (nBlocks > 0 ? nBlocks : 1));
+    cache->data = malloc((size_t)BLOCKSIZE * (nBlocks > 0 ? nBlocks : 1));
+    if (cache->buckets == NULL || cache->entries == NULL || cache->data == NULL ||
+        pthread_mutex_init(&cache->lock, NULL) != 0) {
+        free(cache->buckets);
+        free(cache->entries);
+        free(cache->data);
+        free(cache);
+        return NULL;
+    }
+    for (int i = 0; i < cache->nBuckets; i++) {
+        cache->buckets[i] = -1;
+    }
+    for (int i = 0; i < nBlocks; i++) {
+        cache->entries[i].bNum = -1;
+        cache->entries[i].dirty = 0;
+        cache->entries[i].referenced = 0;
+        cache->entries[i].prev = -1;
+        cache->entries[i].next = -1;
+        cache->entries[i].hashNext = -1;
+    }
+    return cache;
+}
+
+int cacheDestroy(BlockCache *cache) {
+    if (cache == NULL) {
+        return -1;
+    }
+    int result = cacheSync(cache);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache->entries);
+    free(cache->data);
+    free(cache);
+    return result;
+}
+
+int cacheReadBlock(BlockCache *cache, int bNum, void *block) {
+    if (cache->passThrough) {
+        statsCacheAccess(1, 0, 1);
+        return readBlock(cache->disk, bNum, block);
+    }
+    pthread_mutex_lock(&cache->lock);
+    int slot = getSlot(cache, bNum, 1);
+    if (slot != -1) {
+        memcpy(block, slotData(cache, slot), BLOCKSIZE);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return slot == -1 ? -1 : 0; // failure if the block could not be brought into the cache
+}
+
+int cacheWriteBlock(BlockCache *cache, int bNum, void *block) {
+    if (cache->passThrough) {
+        statsCacheAccess(1, 0, 1);
+        return writeBlock(cache->disk, bNum, block);
+    }
+    pthread_mutex_lock(&cache->lock);
+    int slot = getSlot(cache, bNum, 0); // whole block is overwritten, no need to read it first
+    if (slot != -1) {
+        memcpy(slotData(cache, slot), block, BLOCKSIZE);
+        cache->entries[slot].dirty = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return slot == -1 ? -1 : 0; // failure if no slot could be freed
+}
+
+// the bulk calls move file data, which TinyFS never changes from two threads at once
+// (the file's lock is held), so the disk I/O itself can run without the cache lock
+
+int cacheReadBlocks(BlockCache *cache, int startBlock, int count, void *buf) {
+    if (cache->passThrough) {
+        statsCacheAccess(count, 0, count);
+        return readBlocks(cache->disk, startBlock, count, buf);
+    }
+    char *out = buf;
+    int i = 0;
+    while (i < count) {
+        pthread_mutex_lock(&cache->lock);
+        int start = i;
+        int slot;
+        while (i < count && (slot = lookupSlot(cache, startBlock + i)) != -1) {
+            touchSlot(cache, slot);
+            memcpy(out + (size_t)i * BLOCKSIZE, slotData(cache, slot), BLOCKSIZE);
+            i++;
+        }
+        // the whole stretch of blocks that are not cached is read in one go
+        int end = i;
+        while (end < count && lookupSlot(cache, startBlock + end) == -1) {
+            end++;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        statsCacheAccess(end - start, i - start, end - i);
+        if (end > i && readBlocks(cache->disk, startBlock + i, end - i, out + (size_t)i * BLOCKSIZE) != 0) {
+            return -1; // failure (unable to read blocks)
+        }
+        i = end;
+    }
+    return 0;
+}
+
+int cacheResident(BlockCache *cache, int startBlock, int count) {
+    if (cache->passThrough) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache->lock);
+    int found = 0;
+    for (int i = 0; i < count && !found; i++) {
+        found = lookupSlot(cache, startBlock + i) != -1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+void cacheRefresh(BlockCache *cache, int startBlock, int count, void *buf) {
+    statsCacheAccess(count, 0, count); // the data itself goes to libDisk
+    if (cache->passThrough) {
+        return;
+    }
+    // resident copies take the new data and turn clean first, so an eviction
+    // racing with the write that follows cannot put an older copy back on disk
+    pthread_mutex_lock(&cache->lock);
+    for (int i = 0; i < count; i++) {
+        int slot = lookupSlot(cache, startBlock + i);
+        if (slot != -1) {
+            memcpy(slotData(cache, slot), (char *)buf + (size_t)i * BLOCKSIZE, BLOCKSIZE);
+            cache->entries[slot].dirty = 0;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int cacheWriteBlocks(BlockCache *cache, int startBlock, int count, void *buf) {
+    cacheRefresh(cache, startBlock, count, buf);
+    if (writeBlocks(cache->disk, startBlock, count, buf) != 0) {
+        return -1; // failure (unable to write blocks)
+    }
+    return 0;
+}
+
+typedef struct {
+    int bNum;
+    int slot;
+} DirtySlot;
+
+static int compareDirty(const void *a, const void *b) {
+    return ((const DirtySlot *)a)->bNum - ((const DirtySlot *)b)->bNum;
+}
+
+int cacheSync(BlockCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    if (cache->slotsUsed == 0) {
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+    DirtySlot *dirty = malloc(sizeof(DirtySlot) * cache->slotsUsed);
+    void **blocks = malloc(sizeof(void *) * cache->slotsUsed);
+    if (dirty == NULL || blocks == NULL) {
+        free(dirty);
+        free(blocks);
+        pthread_mutex_unlock(&cache->lock);
+        return -1;
+    }
+
+    int nDirty = 0;
+    for (int i = 0; i < cache->slotsUsed; i++) {
+        if (cache->entries[i].bNum != -1 && cache->entries[i].dirty) {
+            dirty[nDirty].bNum = cache->entries[i].bNum;
+            dirty[nDirty].slot = i;
+            nDirty++;
+        }
+    }
+    qsort(dirty, nDirty, sizeof(DirtySlot), compareDirty);
+
+    // write runs of consecutive block numbers with a single pwritev each
+    int result = 0;
+    for (int start = 0; start < nDirty; ) {
+        int end = start;
+        blocks[0] = slotData(cache, dirty[start].slot);
+        while (end + 1 < nDirty && dirty[end + 1].bNum == dirty[end].bNum + 1) {
+            end++;
+            blocks[end - start] = slotData(cache, dirty[end].slot);
+        }
+        if (writeBlocksv(cache->disk, dirty[start].bNum, end - start + 1, blocks) == 0) {
+            for (int i = start; i <= end; i++) {
+                cache->entries[dirty[i].slot].dirty = 0;
+            }
+        } else {
+            result = -1; // keep going, the run stays dirty
+        }
+        start = end + 1;
+    }
+
+    free(dirty);
+    free(blocks);
+    pthread_mutex_unlock(&cache->lock);
+    return result;
+}
+
+void cacheHoldDirty(BlockCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    cache->holdDirty = cache->nSlots > 0;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int cacheDirtyCount(BlockCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    int nDirty = 0;
+    for (int i = 0; i < cache->slotsUsed; i++) {
+        nDirty += cache->entries[i].bNum != -1 && cache->entries[i].dirty;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return nDirty;
+}
+
+int cacheCollectDirty(BlockCache *cache, int **bNums, char **blocks) {
+    pthread_mutex_lock(&cache->lock);
+    int nDirty = 0;
+    for (int i = 0; i < cache->slotsUsed; i++) {
+        nDirty += cache->entries[i].bNum != -1 && cache->entries[i].dirty;
+    }
+    *bNums = malloc(sizeof(int) * (nDirty > 0 ? nDirty : 1));
+    *blocks = malloc((size_t)BLOCKSIZE * (nDirty > 0 ? nDirty : 1));
+    if (*bNums == NULL || *blocks == NULL) {
+        free(*bNums);
+        free(*blocks);
+        pthread_mutex_unlock(&cache->lock);
+        return -1; // failure (out of memory)
+    }
+    int n = 0;
+    for (int i = 0; i < cache->slotsUsed; i++) {
+        if (cache->entries[i].bNum != -1 && cache->entries[i].dirty) {
+            (*bNums)[n] = cache->entries[i].bNum;
+            memcpy(*blocks + (size_t)n * BLOCKSIZE, slotData(cache, i), BLOCKSIZE);
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return n;
+}
@@ -0,0 +1,42 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "libDisk.h"
+
+// replacement policies for the block cache
+#define CACHE_POLICY_LRU 0
+#define CACHE_POLICY_CLOCK 1
+
+#define DEFAULT_CACHE_BLOCKS 16 // blocks kept in memory while a disk is mounted
+
+typedef struct BlockCache BlockCache;
+
+// write-back block cache that sits between TinyFS and libDisk.
+// reads are served from memory when the block is resident, writes only mark
+// the cached copy dirty and reach the disk on eviction or cacheSync().
+// a cache created with nBlocks == 0 passes every call straight to libDisk.
+BlockCache *cacheCreate(int disk, int nBlocks, int policy);
+int cacheDestroy(BlockCache *cache); // flushes dirty blocks, then frees the cache
+int cacheReadBlock(BlockCache *cache, int bNum, void *block);
+int cacheWriteBlock(BlockCache *cache, int bNum, void *block);
+int cacheSync(BlockCache *cache); // write every dirty block back to disk
+
+// bulk transfers of count contiguous blocks. blocks that are not resident move
+// with one readBlocks/writeBlocks call and are not brought into the cache;
+// resident copies are used on read and refreshed on write.
+int cacheReadBlocks(BlockCache *cache, int startBlock, int count, void *buf);
+int cacheWriteBlocks(BlockCache *cache, int startBlock, int count, void *buf);
+
+// for callers that move the data to / from libDisk themselves (asynchronously):
+// whether any of the blocks is resident, and copying new data into resident copies
+int cacheResident(BlockCache *cache, int startBlock, int count);
+void cacheRefresh(BlockCache *cache, int startBlock, int count, void *buf); // call before the write is issued
+
+// for the journal: once holding, dirty blocks stay in the cache (which grows past nBlocks
+// if it must) until cacheSync, so nothing reaches its home location before it is logged
+void cacheHoldDirty(BlockCache *cache);
+int cacheDirtyCount(BlockCache *cache);
+// copies of every dirty block in malloc'd arrays the caller frees, returns how many or -1
+int cacheCollectDirty(BlockCache *cache, int **bNums, char **blocks);
+
+#endif
@@ -0,0 +1,316 @@
+#define _DEFAULT_SOURCE // getauxval under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "checksum.h"
+#include "inode.h"
+#include "tinyFS.h"
+#include "tinyLog.h"
+
+#define CRC32C_POLY 0x82F63B78u // Castagnoli polynomial, bit-reversed
+#define SUM_BATCH 64 // checksums computed per lock round trip
+
+static unsigned int crcTable[8][256];
+
+static void buildTable(void) {
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crcTable[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crcTable[t][i] = (crcTable[t - 1][i] >> 8) ^ crcTable[0][crcTable[t - 1][i] & 0xff];
+        }
+    }
+}
+
+// slicing-by-8: eight table lookups per 8 bytes instead of one per byte
+static unsigned int crcSoftware(unsigned int crc, const unsigned char *p, size_t len) {
+    while (len >= 8) {
+        unsigned int lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24);
+        unsigned int hi = p[4] | p[5] << 8 | p[6] << 16 | (unsigned int)p[7] << 24;
+        crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^
+              crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24] ^
+              crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^
+              crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__) && !defined(CRC32C_SOFTWARE)
+#include <nmmintrin.h>
+#define CRC_TARGET __attribute__((target("sse4.2")))
+#define CRC_WORD(crc, word) _mm_crc32_u64(crc, word)
+#define CRC_BYTE(crc, byte) _mm_crc32_u8(crc, byte)
+
+static int haveHardware(void) {
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__) && !defined(CRC32C_SOFTWARE)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define CRC_TARGET __attribute__((target("+crc")))
+#define CRC_WORD(crc, word) __crc32cd(crc, word)
+#define CRC_BYTE(crc, byte) __crc32cb(crc, byte)
+
+static int haveHardware(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+#ifdef CRC_TARGET
+// the CRC instructions take 3 cycles but can start one every cycle, so long inputs are
+// split into three lanes of LANE_BYTES computed side by side, then joined: a lane's
+// CRC moved past the next lane is shiftLane(crc), a linear map kept as tables.
+// a lane is a third of a block in whole words, so a block needs a single join
+#define LANE_BYTES (BLOCKSIZE / 24 * 8)
+static unsigned int laneTable[4][256];
+
+static unsigned int shiftLane(unsigned int crc) {
+    return laneTable[0][crc & 0xff] ^ laneTable[1][(crc >> 8) & 0xff] ^
+           laneTable[2][(crc >> 16) & 0xff] ^ laneTable[3][crc >> 24];
+}
+
+static void buildLaneTable(void) {
+    static const unsigned char zeros[LANE_BYTES];
+    for (int k = 0; k < 4; k++) {
+        for (unsigned int b = 0; b < 256; b++) {
+            laneTable[k][b] = crcSoftware(b << (8 * k), zeros, LANE_BYTES);
+        }
+    }
+}
+
+CRC_TARGET
+static unsigned int crcHardware(unsigned int crc, const unsigned char *p, size_t len) {
+    unsigned long long a, b, c, word;
+    while (len >= 3 * LANE_BYTES) {
+        a = crc;
+        b = 0;
+        c = 0;
+        for (int i = 0; i < LANE_BYTES; i += 8) {
+            memcpy(&word, p + i, 8);
+            a = CRC_WORD(a, word);
+            memcpy(&word, p + LANE_BYTES + i, 8);
+            b = CRC_WORD(b, word);
+            memcpy(&word, p + 2 * LANE_BYTES + i, 8);
+            c = CRC_WORD(c, word);
+        }
+        crc = shiftLane(shiftLane((unsigned int)a) ^ (unsigned int)b) ^ (unsigned int)c;
+        p += 3 * LANE_BYTES;
+        len -= 3 * LANE_BYTES;
+    }
+    a = crc;
+    while (len >= 8) {
+        memcpy(&word, p, 8);
+        a = CRC_WORD(a, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (unsigned int)a;
+    while (len-- > 0) {
+        crc = CRC_BYTE(crc, *p++);
+    }
+    return crc;
+}
+#else
+#define crcHardware crcSoftware
+static void buildLaneTable(void) {
+}
+
+static int haveHardware(void) {
+    return 0;
+}
+#endif
+
+static unsigned int (*crcUpdate)(unsigned int crc, const unsigned char *p, size_t len);
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void pickCrc(void) {
+    buildTable();
+    buildLaneTable();
+    crcUpdate = haveHardware() ? crcHardware : crcSoftware;
+}
+
+unsigned int crc32c(unsigned int crc, const void *data, size_t len) {
+    pthread_once(&crcOnce, pickCrc);
+    return ~crcUpdate(~crc, data, len);
+}
+
+// checksum recorded for a block, never 0 so 0 can mean none
+static unsigned int blockSum(const char *block) {
+    unsigned int sum = crc32c(0, block, BLOCKSIZE);
+    return sum != 0 ? sum : 1;
+}
+
+struct SumTable {
+    BlockCache *cache;
+    int first;     // disk block of the first table block
+    int nBlocks;   // disk blocks covered
+    unsigned int *sums;
+    int dirtyLow, dirtyHigh; // entries changed since the last store lie in [dirtyLow, dirtyHigh]
+    pthread_mutex_t lock;
+};
+
+int sumTableBlocks(int nBlocks) {
+    return (nBlocks + SUMS_PER_BLOCK - 1) / SUMS_PER_BLOCK;
+}
+
+int sumTableFormat(int disk, int first, int nBlocks) {
+    char block[BLOCKSIZE] = {0};
+    block[_BLOCK_TYPE] = 11; // checksum table block type
+    block[_MAGIC_NUMBER] = 0x44;
+    int nTable = sumTableBlocks(nBlocks);
+    for (int i = 0; i < nTable; i++) {
+        if (writeBlock(disk, first + i, block) != 0) {
+            return TFS_EIO; // failure (unable to write table block)
+        }
+    }
+    return 0;
+}
+
+int sumTableOpen(BlockCache *cache, int first, int nBlocks, SumTable **table) {
+    *table = NULL;
+    SumTable *opened = calloc(1, sizeof(SumTable));
+    if (opened == NULL) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    opened->cache = cache;
+    opened->first = first;
+    opened->nBlocks = nBlocks;
+    opened->dirtyLow = nBlocks;
+    opened->dirtyHigh = -1;
+    pthread_mutex_init(&opened->lock, NULL);
+    opened->sums = calloc(nBlocks, sizeof(unsigned int));
+    char *blocks = malloc((size_t)IO_CHUNK_BLOCKS * BLOCKSIZE);
+    int result = opened->sums == NULL || blocks == NULL ? TFS_ENOMEM : 0;
+
+    int nTable = sumTableBlocks(nBlocks);
+    for (int done = 0; result == 0 && done < nTable; done += IO_CHUNK_BLOCKS) {
+        int run = nTable - done < IO_CHUNK_BLOCKS ? nTable - done : IO_CHUNK_BLOCKS;
+        if (cacheReadBlocks(cache, first + done, run, blocks) != 0) {
+            result = TFS_EIO; // failure (unable to read table blocks)
+            break;
+        }
+        for (int i = 0; i < run && result == 0; i++) {
+            char *block = &blocks[i * BLOCKSIZE];
+            if (block[_BLOCK_TYPE] != 11 || block[_MAGIC_NUMBER] != 0x44) {
+                logError("Checksum table block %d is damaged.\n", first + done + i);
+                result = TFS_ECORRUPT; // failure (not a table block)
+                break;
+            }
+            int base = (done + i) * SUMS_PER_BLOCK;
+            for (int j = 0; j < SUMS_PER_BLOCK && base + j < nBlocks; j++) {
+                opened->sums[base + j] = (unsigned int)getField(block, _SUMS + 4 * j);
+            }
+        }
+    }
+    free(blocks);
+    if (result != 0) {
+        sumTableClose(opened);
+        return result;
+    }
+    *table = opened;
+    return 0;
+}
+
+void sumTableClose(SumTable *table) {
+    if (table == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&table->lock);
+    free(table->sums);
+    free(table);
+}
+
+int sumTableStore(SumTable *table) {
+    pthread_mutex_lock(&table->lock);
+    char block[BLOCKSIZE];
+    int result = 0;
+    int last = table->dirtyHigh >= 0 ? table->dirtyHigh / SUMS_PER_BLOCK : -1; // -1: nothing changed
+    for (int t = table->dirtyLow / SUMS_PER_BLOCK; t <= last; t++) {
+        memset(block, 0, BLOCKSIZE);
+        block[_BLOCK_TYPE] = 11; // checksum table block type
+        block[_MAGIC_NUMBER] = 0x44;
+        int base = t * SUMS_PER_BLOCK;
+        for (int j = 0; j < SUMS_PER_BLOCK && base + j < table->nBlocks; j++) {
+            setField(block, _SUMS + 4 * j, (int)table->sums[base + j]);
+        }
+        if (cacheWriteBlock(table->cache, table->first + t, block) != 0) {
+            result = TFS_EIO; // failure (unable to write table block), the range stays dirty
+            break;
+        }
+    }
+    if (result == 0) {
+        table->dirtyLow = table->nBlocks;
+        table->dirtyHigh = -1;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return result;
+}
+
+void sumTableUpdate(SumTable *table, int bNum, int count, const char *blocks) {
+    if (bNum < 0 || bNum + count > table->nBlocks) {
+        return; // not a block of this disk, the write itself fails
+    }
+    // the checksums are computed outside the lock, only storing them is serialised
+    unsigned int sums[SUM_BATCH];
+    for (int done = 0; done < count; done += SUM_BATCH) {
+        int n = count - done < SUM_BATCH ? count - done : SUM_BATCH;
+        for (int i = 0; i < n; i++) {
+            sums[i] = blockSum(&blocks[(size_t)(done + i) * BLOCKSIZE]);
+        }
+        pthread_mutex_lock(&table->lock);
+        memcpy(&table->sums[bNum + done], sums, n * sizeof(unsigned int));
+        if (bNum + done < table->dirtyLow) {
+            table->dirtyLow = bNum + done;
+        }
+        if (bNum + done + n - 1 > table->dirtyHigh) {
+            table->dirtyHigh = bNum + done + n - 1;
+        }
+        pthread_mutex_unlock(&table->lock);
+    }
+}
+
+void sumTableGet(SumTable *table, int bNum, int count, unsigned int *sums) {
+    pthread_mutex_lock(&table->lock);
+    for (int i = 0; i < count; i++) {
+        sums[i] = bNum + i >= 0 && bNum + i < table->nBlocks ? table->sums[bNum + i] : 0;
+    }
+    pthread_mutex_unlock(&table->lock);
+}
+
+int sumsVerify(const unsigned int *sums, int count, const char *blocks) {
+    for (int i = 0; i < count; i++) {
+        if (sums[i] != 0 && blockSum(&blocks[(size_t)i * BLOCKSIZE]) != sums[i]) {
+            return TFS_ECHECKSUM; // failure (block i changed since it was written)
+        }
+    }
+    return 0;
+}
+
+int sumTableVerify(SumTable *table, int bNum, int count, const char *blocks) {
+    unsigned int sums[SUM_BATCH];
+    for (int done = 0; done < count; done += SUM_BATCH) {
+        int n = count - done < SUM_BATCH ? count - done : SUM_BATCH;
+        sumTableGet(table, bNum + done, n, sums);
+        for (int i = 0; i < n; i++) {
+            if (sumsVerify(&sums[i], 1, &blocks[(size_t)(done + i) * BLOCKSIZE]) != 0) {
+                logError("Block %d does not match its checksum.\n", bNum + done + i);
+                return TFS_ECHECKSUM; // failure (block damaged on disk)
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include "blockCache.h"
+
+// CRC32C (Castagnoli) of len bytes, continuing from crc (0 to start). uses the SSE4.2
+// or ARMv8 CRC instructions when the CPU has them, slicing-by-8 tables otherwise
+// (always with -DCRC32C_SOFTWARE)
+unsigned int crc32c(unsigned int crc, const void *data, size_t len);
+
+// the checksum table of a disk: a CRC32C per disk block, kept in the table blocks that
+// follow the bitmap and in memory while mounted, like the free-block bitmap. 0 means no
+// checksum was recorded, the block is not checked. safe to use from any number of threads
+typedef struct SumTable SumTable;
+
+int sumTableBlocks(int nBlocks); // table blocks a disk of nBlocks blocks needs
+int sumTableFormat(int disk, int first, int nBlocks); // write an empty table starting at block first
+// *table = the table starting at block first, read through cache
+int sumTableOpen(BlockCache *cache, int first, int nBlocks, SumTable **table);
+void sumTableClose(SumTable *table);
+int sumTableStore(SumTable *table); // write changed table blocks back through the cache
+
+// record the checksums of count blocks about to be written at bNum
+void sumTableUpdate(SumTable *table, int bNum, int count, const char *blocks);
+// TFS_ECHECKSUM if one of count blocks read from bNum does not match its checksum
+int sumTableVerify(SumTable *table, int bNum, int count, const char *blocks);
+
+// for blocks checked later: their recorded checksums now, then the check itself
+void sumTableGet(SumTable *table, int bNum, int count, unsigned int *sums);
+int sumsVerify(const unsigned int *sums, int count, const char *blocks);
+
+#endif
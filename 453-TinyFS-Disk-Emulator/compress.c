@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#include "inode.h"
+#include "TinyFS_errno.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5 // a match never reaches the last bytes, so the stream always ends in literals
+
+static unsigned int read32(const unsigned char *p) {
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int lzHash(unsigned int v) {
+    return (int)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+// a length too long for its 4 bits of token: 255s, then the rest
+static unsigned char *putLength(unsigned char *out, int length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+// one sequence: literals [literal, literal + nLiterals), then a match (none when matchLength is 0).
+// NULL if it would pass end
+static unsigned char *putSequence(unsigned char *out, unsigned char *end, const unsigned char *literal,
+                                  int nLiterals, int offset, int matchLength) {
+    if (end - out < 1 + nLiterals / 255 + 1 + nLiterals + 2 + matchLength / 255 + 1) {
+        return NULL; // failure (dst too small)
+    }
+    unsigned char *token = out++;
+    *token = (unsigned char)((nLiterals < 15 ? nLiterals : 15) << 4);
+    if (nLiterals >= 15) {
+        out = putLength(out, nLiterals - 15);
+    }
+    memcpy(out, literal, nLiterals);
+    out += nLiterals;
+    if (matchLength == 0) {
+        return out; // last sequence, literals only
+    }
+    *out++ = (unsigned char)(offset & 0xff);
+    *out++ = (unsigned char)(offset >> 8);
+    int extra = matchLength - LZ_MIN_MATCH;
+    *token |= (unsigned char)(extra < 15 ? extra : 15);
+    if (extra >= 15) {
+        out = putLength(out, extra - 15);
+    }
+    return out;
+}
+
+int lzCompress(const char *src, int srcLen, char *dst, int dstCapacity) {
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst;
+    unsigned char *end = out + dstCapacity;
+    int table[1 << LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+
+    int anchor = 0; // first byte not yet emitted
+    int pos = 0;
+    int misses = 0; // incompressible data is skipped faster and faster
+    int limit = srcLen - LZ_LAST_LITERALS - LZ_MIN_MATCH;
+    while (pos <= limit) {
+        unsigned int sequence = read32(in + pos);
+        int h = lzHash(sequence);
+        int candidate = table[h];
+        table[h] = pos;
+        if (candidate < 0 || pos - candidate > LZ_MAX_OFFSET || read32(in + candidate) != sequence) {
+            pos += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+        int length = LZ_MIN_MATCH;
+        while (pos + length < srcLen - LZ_LAST_LITERALS && in[candidate + length] == in[pos + length]) {
+            length++;
+        }
+        out = putSequence(out, end, in + anchor, pos - anchor, pos - candidate, length);
+        if (out == NULL) {
+            return 0; // failure (does not fit)
+        }
+        pos += length;
+        anchor = pos;
+    }
+    out = putSequence(out, end, in + anchor, srcLen - anchor, 0, 0);
+    if (out == NULL) {
+        return 0; // failure (does not fit)
+    }
+    return (int)(out - (unsigned char *)dst);
+}
+
+// a length continued past its 4 bits of token, -1 if it runs off the end of the input
+static int getLength(const unsigned char **in, const unsigned char *end, int length) {
+    unsigned char byte;
+    do {
+        if (*in >= end) {
+            return -1;
+        }
+        byte = *(*in)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+int lzDecompress(const char *src, int srcLen, char *dst, int dstCapacity) {
+    const unsigned char *in = (const unsigned char *)src;
+    const unsigned char *inEnd = in + srcLen;
+    unsigned char *out = (unsigned char *)dst;
+    unsigned char *outEnd = out + dstCapacity;
+    while (in < inEnd) {
+        int token = *in++;
+        int nLiterals = token >> 4;
+        if (nLiterals == 15 && (nLiterals = getLength(&in, inEnd, nLiterals)) < 0) {
+            return -1; // failure (truncated length)
+        }
+        if (nLiterals > inEnd - in || nLiterals > outEnd - out) {
+            return -1; // failure (literals run past either end)
+        }
+        memcpy(out, in, nLiterals);
+        in += nLiterals;
+        out += nLiterals;
+        if (in == inEnd) {
+            break; // last sequence has no match
+        }
+
+        if (inEnd - in < 2) {
+            return -1; // failure (truncated offset)
+        }
+        int offset = in[0] | in[1] << 8;
+        in += 2;
+        int length = token & 15;
+        if (length == 15 && (length = getLength(&in, inEnd, length)) < 0) {
+            return -1; // failure (truncated length)
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out - (unsigned char *)dst || length > outEnd - out) {
+            return -1; // failure (match outside the data)
+        }
+        const unsigned char *match = out - offset;
+        if (offset >= length) {
+            memcpy(out, match, length);
+            out += length;
+        } else {
+            while (length-- > 0) {
+                *out++ = *match++; // overlapping: repeats the last offset bytes
+            }
+        }
+    }
+    return (int)(out - (unsigned char *)dst);
+}
+
+void chunkMapInit(ChunkMap *map) {
+    map->count = 0;
+    map->start = NULL;
+}
+
+void chunkMapDestroy(ChunkMap *map) {
+    free(map->start);
+    chunkMapInit(map);
+}
+
+static int chunkCount(int size) {
+    return (size + COMPRESS_CHUNK - 1) / COMPRESS_CHUNK;
+}
+
+// bytes of data in chunk index of a size byte file
+static int chunkLength(int size, int index) {
+    return size - index * COMPRESS_CHUNK < COMPRESS_CHUNK ? size - index * COMPRESS_CHUNK : COMPRESS_CHUNK;
+}
+
+int chunkHeaderBytes(int size) {
+    return chunkCount(size) * 4;
+}
+
+int chunkMapParse(ChunkMap *map, int size, char *header) {
+    int count = chunkCount(size);
+    int *start = malloc((count + 1) * sizeof(int));
+    if (start == NULL) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    start[0] = chunkHeaderBytes(size);
+    for (int i = 0; i < count; i++) {
+        int length = getField(header, 4 * i);
+        if (length < 1 || length > chunkLength(size, i)) {
+            free(start);
+            return TFS_ECORRUPT; // failure (chunk cannot be that long)
+        }
+        start[i + 1] = start[i] + length;
+    }
+    chunkMapDestroy(map);
+    map->count = count;
+    map->start = start;
+    return 0;
+}
+
+int compressStream(char *data, int size, char **stream, int *streamSize, ChunkMap *map) {
+    int count = chunkCount(size);
+    char *out = malloc((size_t)chunkHeaderBytes(size) + size + 1); // worst case: every chunk stored as it is
+    int *start = malloc((count + 1) * sizeof(int));
+    if (out == NULL || start == NULL) {
+        free(out);
+        free(start);
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    start[0] = chunkHeaderBytes(size);
+    for (int i = 0; i < count; i++) {
+        char *chunk = data + (size_t)i * COMPRESS_CHUNK;
+        int length = chunkLength(size, i);
+        // kept compressed only if that saves at least a byte
+        int packed = lzCompress(chunk, length, out + start[i], length - 1);
+        if (packed == 0) {
+            memcpy(out + start[i], chunk, length);
+            packed = length;
+        }
+        setField(out, 4 * i, packed);
+        start[i + 1] = start[i] + packed;
+    }
+    chunkMapDestroy(map);
+    map->count = count;
+    map->start = start;
+    *stream = out;
+    *streamSize = start[count];
+    return 0;
+}
+
+int decompressChunk(ChunkMap *map, int size, int index, char *packed, char *data) {
+    int length = chunkLength(size, index);
+    int stored = map->start[index + 1] - map->start[index];
+    if (stored == length) {
+        memcpy(data, packed, length); // did not shrink, stored as it is
+        return length;
+    }
+    if (lzDecompress(packed, stored, data, length) != length) {
+        return TFS_ECORRUPT; // failure (damaged chunk)
+    }
+    return length;
+}
+
+void chunkBufferInit(ChunkBuffer *buffer) {
+    memset(buffer, 0, sizeof(ChunkBuffer));
+    buffer->index = -1;
+}
+
+void chunkBufferDrop(ChunkBuffer *buffer) {
+    free(buffer->data);
+    free(buffer->packed);
+    chunkBufferInit(buffer);
+}
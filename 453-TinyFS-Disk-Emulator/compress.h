@@ -0,0 +1,44 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+// bytes of file data compressed as one unit. a read decompresses whole chunks, so
+// this is what a seek followed by a one byte read costs at most
+#define COMPRESS_CHUNK (BLOCKSIZE < 4096 ? 4096 : BLOCKSIZE)
+
+// LZ4-style byte codec: sequences of literals and (offset, length) matches into the
+// last 64 KB. lzCompress returns the bytes written to dst, 0 if they would not fit in
+// dstCapacity. lzDecompress returns the bytes written to dst, -1 if src is damaged
+int lzCompress(const char *src, int srcLen, char *dst, int dstCapacity);
+int lzDecompress(const char *src, int srcLen, char *dst, int dstCapacity);
+
+// data stream of a compressed file (inode flag INODE_COMPRESSED), stored in its data
+// blocks like the bytes of any other file: an int per chunk with the bytes it takes,
+// then the chunks back to back. a chunk that did not shrink is stored as it is
+typedef struct {
+    int count;  // chunks, 0 for an empty or uncompressed file
+    int *start; // count + 1 entries: stream byte each chunk starts at, then the end of the stream
+} ChunkMap;
+
+void chunkMapInit(ChunkMap *map);
+void chunkMapDestroy(ChunkMap *map);
+int chunkHeaderBytes(int size); // header bytes of the stream of a size byte file
+// map of a size byte file from the first chunkHeaderBytes(size) bytes of its stream
+int chunkMapParse(ChunkMap *map, int size, char *header);
+// the stream for size bytes of data in a new malloc'd *stream, map describing it
+int compressStream(char *data, int size, char **stream, int *streamSize, ChunkMap *map);
+// decompress chunk index of a size byte file, read from the stream into packed, into data
+int decompressChunk(ChunkMap *map, int size, int index, char *packed, char *data);
+
+// the chunk a descriptor decompressed last, kept for the reads after it
+typedef struct {
+    int index;      // chunk held, -1 = none
+    int generation; // OpenFile generation it was read at
+    int length;     // bytes of data held
+    char *data;     // COMPRESS_CHUNK bytes each, allocated on first use
+    char *packed;
+} ChunkBuffer;
+
+void chunkBufferInit(ChunkBuffer *buffer);
+void chunkBufferDrop(ChunkBuffer *buffer);
+
+#endif
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinyFS.h"
+#include "inode.h"
+#include "directory.h"
+
+typedef struct {
+    char name[MAX_NAME_LENGTH + 1]; // "" while the slot is free
+    int inodeNumber;
+    int next; // next slot in the same hash bucket (-1 = end of chain)
+} DirEntry;
+
+struct Directory {
+    BlockCache *cache;
+    Bitmap *freeMap;
+    int *blocks;        // directory block chain, in order
+    int numBlocks;
+    DirEntry *entries;  // one per on-disk slot: slot = block index * DIR_ENTRIES_PER_BLOCK + entry
+    int *freeSlots;     // stack of unused slots
+    int numFreeSlots;
+    int *buckets;       // hash bucket -> first slot (-1 if empty)
+    int nBuckets;       // power of 2
+    int count;          // names in the directory
+};
+
+// FNV-1a over the (at most MAX_NAME_LENGTH) characters that are stored
+static unsigned int hashName(const char *name) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < MAX_NAME_LENGTH && name[i] != '\0'; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int sameName(const char *stored, const char *name) {
+    return strncmp(stored, name, MAX_NAME_LENGTH) == 0;
+}
+
+static void bucketInsert(Directory *dir, int slot) {
+    int b = hashName(dir->entries[slot].name) & (dir->nBuckets - 1);
+    dir->entries[slot].next = dir->buckets[b];
+    dir->buckets[b] = slot;
+}
+
+// double the bucket array once the table is fuller than one name per bucket
+static int growBuckets(Directory *dir) {
+    if (dir->count < dir->nBuckets) {
+        return 0;
+    }
+    int *buckets = malloc(sizeof(int) * dir->nBuckets * 2);
+    if (buckets == NULL) {
+        return -1; // failure (out of memory), lookups still work, just slower
+    }
+    free(dir->buckets);
+    dir->buckets = buckets;
+    dir->nBuckets *= 2;
+    for (int b = 0; b < dir->nBuckets; b++) {
+        dir->buckets[b] = -1;
+    }
+    for (int slot = 0; slot < dir->numBlocks * DIR_ENTRIES_PER_BLOCK; slot++) {
+        if (dir->entries[slot].name[0] != '\0') {
+            bucketInsert(dir, slot);
+        }
+    }
+    return 0;
+}
+
+// rebuild directory block index from the in-memory entries and write it through the cache
+static int storeDirBlock(Directory *dir, int index) {
+    char block[BLOCKSIZE] = {0};
+    block[_BLOCK_TYPE] = 7; // directory block type
+    block[_MAGIC_NUMBER] = 0x44;
+    setField(block, _NEXT_DIR_BLOCK, index + 1 < dir->numBlocks ? dir->blocks[index + 1] : 0);
+    for (int i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+        DirEntry *e = &dir->entries[index * DIR_ENTRIES_PER_BLOCK + i];
+        if (e->name[0] != '\0') {
+            memcpy(&block[_DIR_ENTRIES + i * DIR_ENTRY_SIZE], e->name, MAX_NAME_LENGTH + 1);
+            setField(block, _DIR_ENTRIES + i * DIR_ENTRY_SIZE + 12, e->inodeNumber);
+        }
+    }
+    return cacheWriteBlock(dir->cache, dir->blocks[index], block);
+}
+
+// make room for one more directory block in memory, its slots start out free
+static int addBlock(Directory *dir, int bNum) {
+    int n = dir->numBlocks + 1;
+    int *blocks = realloc(dir->blocks, sizeof(int) * n);
+    if (blocks == NULL) {
+        return -1;
+    }
+    dir->blocks = blocks;
+    DirEntry *entries = realloc(dir->entries, sizeof(DirEntry) * n * DIR_ENTRIES_PER_BLOCK);
+    if (entries == NULL) {
+        return -1;
+    }
+    dir->entries = entries;
+    int *freeSlots = realloc(dir->freeSlots, sizeof(int) * n * DIR_ENTRIES_PER_BLOCK);
+    if (freeSlots == NULL) {
+        return -1;
+    }
+    dir->freeSlots = freeSlots;
+
+    dir->blocks[dir->numBlocks] = bNum;
+    // push in reverse so the lowest slot is handed out first
+    for (int i = DIR_ENTRIES_PER_BLOCK - 1; i >= 0; i--) {
+        int slot = dir->numBlocks * DIR_ENTRIES_PER_BLOCK + i;
+        dir->entries[slot].name[0] = '\0';
+        dir->entries[slot].inodeNumber = 0;
+        dir->entries[slot].next = -1;
+        dir->freeSlots[dir->numFreeSlots++] = slot;
+    }
+    dir->numBlocks = n;
+    return 0;
+}
+
+static Directory *dirAlloc(BlockCache *cache, Bitmap *freeMap) {
+    Directory *dir = calloc(1, sizeof(Directory));
+    if (dir == NULL) {
+        return NULL;
+    }
+    dir->cache = cache;
+    dir->freeMap = freeMap;
+    dir->nBuckets = 16;
+    dir->buckets = malloc(sizeof(int) * dir->nBuckets);
+    if (dir->buckets == NULL) {
+        free(dir);
+        return NULL;
+    }
+    for (int b = 0; b < dir->nBuckets; b++) {
+        dir->buckets[b] = -1;
+    }
+    return dir;
+}
+
+// allocate a directory block and append it to the chain
+static int extendChain(Directory *dir) {
+    int bNum = bitmapFindRun(dir->freeMap, 1, 1);
+    if (bNum == -1) {
+        return -1; // failure (disk full)
+    }
+    bitmapSet(dir->freeMap, bNum, 1);
+    if (addBlock(dir, bNum) != 0) {
+        bitmapClear(dir->freeMap, bNum, 1);
+        return -1;
+    }
+    // the new block and the one that now links to it
+    if (storeDirBlock(dir, dir->numBlocks - 1) != 0 ||
+        (dir->numBlocks > 1 && storeDirBlock(dir, dir->numBlocks - 2) != 0)) {
+        return -1; // failure (unable to write directory block)
+    }
+    return 0;
+}
+
+Directory *dirCreate(BlockCache *cache, Bitmap *freeMap) {
+    Directory *dir = dirAlloc(cache, freeMap);
+    if (dir == NULL) {
+        return NULL;
+    }
+    if (extendChain(dir) != 0) {
+        dirDestroy(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+Directory *dirLoad(BlockCache *cache, Bitmap *freeMap, int firstBlock) {
+    Directory *dir = dirAlloc(cache, freeMap);
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    char block[BLOCKSIZE];
+    for (int bNum = firstBlock; bNum > 0; bNum = getField(block, _NEXT_DIR_BLOCK)) {
+        // a directory block has to be in use and look like one, and the chain cannot be longer than the disk
+        if (bNum >= freeMap->nBits || !bitmapTest(freeMap, bNum) || dir->numBlocks >= freeMap->nBits ||
+            cacheReadBlock(cache, bNum, block) != 0 ||
+            block[_BLOCK_TYPE] != 7 || block[_MAGIC_NUMBER] != 0x44 ||
+            addBlock(dir, bNum) != 0) {
+            dirDestroy(dir);
+            return NULL; // failure (chain missing or damaged)
+        }
+        int base = (dir->numBlocks - 1) * DIR_ENTRIES_PER_BLOCK;
+        for (int i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+            char *raw = &block[_DIR_ENTRIES + i * DIR_ENTRY_SIZE];
+            if (raw[0] == '\0') {
+                continue;
+            }
+            DirEntry *e = &dir->entries[base + i];
+            memcpy(e->name, raw, MAX_NAME_LENGTH);
+            e->name[MAX_NAME_LENGTH] = '\0';
+            e->inodeNumber = getField(raw, 12);
+        }
+    }
+    if (dir->numBlocks == 0) {
+        dirDestroy(dir);
+        return NULL; // failure (no directory recorded)
+    }
+
+    // free slot stack and hash chains from what was read
+    dir->numFreeSlots = 0;
+    for (int slot = dir->numBlocks * DIR_ENTRIES_PER_BLOCK - 1; slot >= 0; slot--) {
+        if (dir->entries[slot].name[0] == '\0') {
+            dir->freeSlots[dir->numFreeSlots++] = slot;
+        } else {
+            dir->count++;
+        }
+    }
+    while (dir->nBuckets < dir->count) {
+        dir->nBuckets *= 2;
+    }
+    free(dir->buckets);
+    dir->buckets = malloc(sizeof(int) * dir->nBuckets);
+    if (dir->buckets == NULL) {
+        dirDestroy(dir);
+        return NULL;
+    }
+    for (int b = 0; b < dir->nBuckets; b++) {
+        dir->buckets[b] = -1;
+    }
+    for (int slot = 0; slot < dir->numBlocks * DIR_ENTRIES_PER_BLOCK; slot++) {
+        if (dir->entries[slot].name[0] != '\0') {
+            bucketInsert(dir, slot);
+        }
+    }
+    return dir;
+}
+
+void dirDestroy(Directory *dir) {
+    if (dir == NULL) {
+        return;
+    }
+    free(dir->blocks);
+    free(dir->entries);
+    free(dir->freeSlots);
+    free(dir->buckets);
+    free(dir);
+}
+
+int dirFirstBlock(Directory *dir) {
+    return dir->numBlocks > 0 ? dir->blocks[0] : 0;
+}
+
+static int findSlot(Directory *dir, const char *name) {
+    int b = hashName(name) & (dir->nBuckets - 1);
+    for (int slot = dir->buckets[b]; slot != -1; slot = dir->entries[slot].next) {
+        if (sameName(dir->entries[slot].name, name)) {
+            return slot;
+        }
+    }
+    return -1; // not in the directory
+}
+
+int dirLookup(Directory *dir, const char *name) {
+    int slot = findSlot(dir, name);
+    return slot == -1 ? -1 : dir->entries[slot].inodeNumber;
+}
+
+int dirInsert(Directory *dir, const char *name, int inodeNumber) {
+    if (name == NULL || name[0] == '\0' || findSlot(dir, name) != -1) {
+        return -1; // failure (bad or duplicate name)
+    }
+    if (dir->numFreeSlots == 0 && extendChain(dir) != 0) {
+        return -1; // failure (no room for another directory block)
+    }
+
+    int slot = dir->freeSlots[--dir->numFreeSlots];
+    DirEntry *e = &dir->entries[slot];
+    strncpy(e->name, name, MAX_NAME_LENGTH);
+    e->name[MAX_NAME_LENGTH] = '\0';
+    e->inodeNumber = inodeNumber;
+    dir->count++;
+    bucketInsert(dir, slot);
+    growBuckets(dir);
+    return storeDirBlock(dir, slot / DIR_ENTRIES_PER_BLOCK);
+}
+
+int dirRemove(Directory *dir, const char *name) {
+    int b = hashName(name) & (dir->nBuckets - 1);
+    int *link = &dir->buckets[b];
+    while (*link != -1 && !sameName(dir->entries[*link].name, name)) {
+        link = &dir->entries[*link].next;
+    }
+    if (*link == -1) {
+        return -1; // failure (name not in the directory)
+    }
+
+    int slot = *link;
+    *link = dir->entries[slot].next;
+    dir->entries[slot].name[0] = '\0';
+    dir->entries[slot].inodeNumber = 0;
+    dir->entries[slot].next = -1;
+    dir->freeSlots[dir->numFreeSlots++] = slot;
+    dir->count--;
+    return storeDirBlock(dir, slot / DIR_ENTRIES_PER_BLOCK);
+}
+
+int dirClear(Directory *dir) {
+    for (int b = 0; b < dir->nBuckets; b++) {
+        dir->buckets[b] = -1;
+    }
+    dir->numFreeSlots = 0;
+    for (int slot = dir->numBlocks * DIR_ENTRIES_PER_BLOCK - 1; slot >= 0; slot--) {
+        dir->entries[slot].name[0] = '\0';
+        dir->entries[slot].inodeNumber = 0;
+        dir->entries[slot].next = -1;
+        dir->freeSlots[dir->numFreeSlots++] = slot;
+    }
+    dir->count = 0;
+    for (int i = 0; i < dir->numBlocks; i++) {
+        if (storeDirBlock(dir, i) != 0) {
+            return -1; // failure (unable to write directory block)
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include "blockCache.h"
+#include "bitmap.h"
+
+// root directory: name -> inode number. the entries live in a chain of
+// directory blocks (block type 7) and are loaded into an in-memory hash table
+// at mount, so lookups never touch the disk. every insert or remove rewrites
+// only the one directory block holding the entry.
+typedef struct Directory Directory;
+
+Directory *dirCreate(BlockCache *cache, Bitmap *freeMap); // new empty directory with one block
+Directory *dirLoad(BlockCache *cache, Bitmap *freeMap, int firstBlock); // NULL if the chain is missing or damaged
+void dirDestroy(Directory *dir);
+
+int dirFirstBlock(Directory *dir); // where the chain starts, recorded in the superblock
+int dirLookup(Directory *dir, const char *name); // inode number of name, -1 if there is none
+int dirInsert(Directory *dir, const char *name, int inodeNumber);
+int dirRemove(Directory *dir, const char *name);
+int dirClear(Directory *dir); // drop every entry (used before rebuilding from the inode blocks)
+
+#endif
@@ -5,7 +5,6 @@
 #include "libDisk.h"
 
 #define NUM_TEST_DISKS 4 /* number of disks to test with */
-#define BLOCKSIZE 256
 
 
 #define NUM_BLOCKS 50 /* total number of blocks on each disk */
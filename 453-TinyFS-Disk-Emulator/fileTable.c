@@ -0,0 +1,170 @@
+#define _DEFAULT_SOURCE // pthread rwlocks under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fileTable.h"
+
+#define INITIAL_DESCRIPTORS 16
+
+int fileTableInit(FileTable *table) {
+    memset(table, 0, sizeof(FileTable));
+    table->freeHead = -1;
+    if (pthread_mutex_init(&table->lock, NULL) != 0) {
+        return -1; // failure (unable to create lock)
+    }
+    return 0;
+}
+
+static void freeOpenFile(OpenFile *file) {
+    pthread_rwlock_destroy(&file->lock);
+    extentMapDestroy(&file->extents);
+    chunkMapDestroy(&file->chunks);
+    free(file);
+}
+
+void fileTableDestroy(FileTable *table) {
+    for (int fd = 0; fd < table->capacity; fd++) {
+        fdRelease(table, fd); // no-op for free descriptors
+        free(table->entries[fd]);
+    }
+    free(table->entries);
+    // open files that were deleted are no longer hashed, but still freed with their last descriptor above
+    pthread_mutex_destroy(&table->lock);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->freeHead = -1;
+}
+
+static OpenFile **bucketFor(FileTable *table, int inodeNumber) {
+    return &table->buckets[(unsigned int)inodeNumber % OPEN_FILE_BUCKETS];
+}
+
+OpenFile *openFileGet(FileTable *table, int inodeNumber) {
+    pthread_mutex_lock(&table->lock);
+    OpenFile *file = *bucketFor(table, inodeNumber);
+    while (file != NULL && file->inodeNumber != inodeNumber) {
+        file = file->hashNext;
+    }
+    if (file != NULL) {
+        file->refCount++;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return file;
+}
+
+void openFileAdd(FileTable *table, OpenFile *file) {
+    pthread_mutex_lock(&table->lock);
+    OpenFile **bucket = bucketFor(table, file->inodeNumber);
+    file->refCount = 1;
+    file->generation = 0;
+    pthread_rwlock_init(&file->lock, NULL);
+    file->hashNext = *bucket;
+    *bucket = file;
+    pthread_mutex_unlock(&table->lock);
+}
+
+// caller holds the lock
+static void unhash(FileTable *table, OpenFile *file) {
+    OpenFile **link = bucketFor(table, file->inodeNumber);
+    while (*link != NULL && *link != file) {
+        link = &(*link)->hashNext;
+    }
+    if (*link == file) {
+        *link = file->hashNext;
+    }
+    file->hashNext = NULL;
+}
+
+// caller holds the lock
+static void dropReference(FileTable *table, OpenFile *file) {
+    if (--file->refCount == 0) {
+        unhash(table, file);
+        freeOpenFile(file);
+    }
+}
+
+void openFilePut(FileTable *table, OpenFile *file) {
+    pthread_mutex_lock(&table->lock);
+    dropReference(table, file);
+    pthread_mutex_unlock(&table->lock);
+}
+
+void openFileForget(FileTable *table, OpenFile *file) {
+    pthread_mutex_lock(&table->lock);
+    unhash(table, file);
+    file->inodeNumber = -1;
+    pthread_mutex_unlock(&table->lock);
+}
+
+// double the table and put the new descriptors on the free list, caller holds the lock
+static int growTable(FileTable *table) {
+    int newCapacity = table->capacity ? table->capacity * 2 : INITIAL_DESCRIPTORS;
+    FileTableEntry **grown = realloc(table->entries, sizeof(FileTableEntry *) * newCapacity);
+    if (grown == NULL) {
+        return -1; // failure (out of memory)
+    }
+    table->entries = grown;
+    for (int fd = table->capacity; fd < newCapacity; fd++) {
+        table->entries[fd] = calloc(1, sizeof(FileTableEntry));
+        if (table->entries[fd] == NULL) {
+            while (--fd >= table->capacity) {
+                free(table->entries[fd]);
+            }
+            return -1; // failure (out of memory)
+        }
+    }
+    // new descriptors are pushed in reverse so the lowest one is handed out first
+    for (int fd = newCapacity - 1; fd >= table->capacity; fd--) {
+        table->entries[fd]->nextFree = table->freeHead;
+        table->freeHead = fd;
+    }
+    table->capacity = newCapacity;
+    return 0;
+}
+
+int fdAlloc(FileTable *table, OpenFile *file) {
+    pthread_mutex_lock(&table->lock);
+    if (table->freeHead == -1 && growTable(table) != 0) {
+        pthread_mutex_unlock(&table->lock);
+        return -1; // failure (descriptor table full)
+    }
+    int fd = table->freeHead;
+    FileTableEntry *entry = table->entries[fd];
+    table->freeHead = entry->nextFree;
+    entry->file = file;
+    entry->filePointer = 0;
+    readAheadInit(&entry->readAhead);
+    chunkBufferInit(&entry->chunk);
+    entry->nextFree = -1;
+    pthread_mutex_unlock(&table->lock);
+    return fd;
+}
+
+FileTableEntry *fdGet(FileTable *table, int fd) {
+    FileTableEntry *entry = NULL;
+    pthread_mutex_lock(&table->lock);
+    if (fd >= 0 && fd < table->capacity && table->entries[fd]->file != NULL) {
+        entry = table->entries[fd];
+    }
+    pthread_mutex_unlock(&table->lock);
+    return entry;
+}
+
+int fdRelease(FileTable *table, int fd) {
+    pthread_mutex_lock(&table->lock);
+    if (fd < 0 || fd >= table->capacity || table->entries[fd]->file == NULL) {
+        pthread_mutex_unlock(&table->lock);
+        return -1; // failure (descriptor not open)
+    }
+    FileTableEntry *entry = table->entries[fd];
+    OpenFile *file = entry->file;
+    readAheadDrop(&entry->readAhead); // before the entry can be handed out again
+    chunkBufferDrop(&entry->chunk);
+    entry->file = NULL;
+    entry->filePointer = -1;
+    entry->nextFree = table->freeHead;
+    table->freeHead = fd;
+    dropReference(table, file);
+    pthread_mutex_unlock(&table->lock);
+    return 0;
+}
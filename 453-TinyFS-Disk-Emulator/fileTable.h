@@ -0,0 +1,59 @@
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include <pthread.h>
+#include "libDisk.h"
+#include "compress.h"
+#include "inode.h"
+#include "readAhead.h"
+
+#define OPEN_FILE_BUCKETS 64 // hash buckets for open files, keyed by inode number
+
+// state shared by every descriptor open on the same file: a copy of its inode
+// and its extent list, so reads and writes never fetch metadata again
+typedef struct OpenFile {
+    int inodeNumber;       // -1 once the file has been deleted
+    char inode[BLOCKSIZE]; // kept equal to the inode on disk (its first INODE_SIZE bytes on disks with an inode map)
+    ExtentMap extents;
+    ChunkMap chunks;       // where the chunks of a compressed file start in its data
+    int refCount;          // descriptors using this file
+    int generation;        // bumped by every write and delete, read-ahead of older data is dropped
+    pthread_rwlock_t lock; // shared by readers, exclusive for writes and delete
+    struct OpenFile *hashNext;
+} OpenFile;
+
+typedef struct {
+    OpenFile *file; // NULL while the descriptor is free
+    int filePointer;
+    ReadAhead readAhead; // prefetched blocks after filePointer while reads are sequential
+    ChunkBuffer chunk;   // last chunk of a compressed file this descriptor decompressed
+    int nextFree;   // next free descriptor (-1 = end of list)
+} FileTableEntry;
+
+// growable descriptor table: free descriptors form a list, so open and close are O(1).
+// all table operations take the table lock. a descriptor itself (its file pointer)
+// belongs to one thread at a time, and must not be closed while another thread uses it.
+typedef struct {
+    FileTableEntry **entries; // one allocation per entry, so entries never move when the table grows
+    int capacity;
+    int freeHead;
+    OpenFile *buckets[OPEN_FILE_BUCKETS];
+    pthread_mutex_t lock;
+} FileTable;
+
+int fileTableInit(FileTable *table);
+void fileTableDestroy(FileTable *table); // drops every descriptor and open file
+
+// open file for inodeNumber with one more reference, NULL if it is not open yet
+OpenFile *openFileGet(FileTable *table, int inodeNumber);
+// register a new open file (refCount 1), file->inode and file->extents already filled in
+void openFileAdd(FileTable *table, OpenFile *file);
+void openFilePut(FileTable *table, OpenFile *file); // drop a reference taken without a descriptor
+// the file was deleted: later lookups miss it and its descriptors report an invalid file
+void openFileForget(FileTable *table, OpenFile *file);
+
+int fdAlloc(FileTable *table, OpenFile *file); // new descriptor on file (takes one reference), -1 on failure
+FileTableEntry *fdGet(FileTable *table, int fd); // NULL if fd is not open
+int fdRelease(FileTable *table, int fd); // close fd, freeing the open file with its last reference
+
+#endif
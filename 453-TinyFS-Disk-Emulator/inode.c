@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tinyFS.h"
+#include "inode.h"
+
+int getField(char *block, int offset) {
+    unsigned char *p = (unsigned char *)&block[offset];
+    return (int)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+void setField(char *block, int offset, int value) {
+    unsigned char *p = (unsigned char *)&block[offset];
+    uint32_t v = (uint32_t)value;
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+int getInodeSize(char *inode) {
+    if (inode[_INODE_FORMAT] < 2) {
+        return (unsigned char)inode[_SIZE]; // original inodes keep the size in a single byte
+    }
+    return getField(inode, _SIZE);
+}
+
+void setInodeSize(char *inode, int size) {
+    inode[_INODE_FORMAT] = 2;
+    setField(inode, _SIZE, size);
+}
+
+void extentMapInit(ExtentMap *map) {
+    map->extents = NULL;
+    map->count = 0;
+    map->capacity = 0;
+    map->indirect = NULL;
+    map->numIndirect = 0;
+    map->numBlocks = 0;
+}
+
+void extentMapDestroy(ExtentMap *map) {
+    free(map->extents);
+    free(map->indirect);
+    extentMapInit(map);
+}
+
+static int appendExtent(ExtentMap *map, int start, int length) {
+    if (length <= 0) {
+        return 0;
+    }
+    // merge with the last extent when the new blocks follow it directly
+    if (map->count > 0) {
+        Extent *last = &map->extents[map->count - 1];
+        if (last->start + last->length == start) {
+            last->length += length;
+            map->numBlocks += length;
+            return 0;
+        }
+    }
+    if (map->count == map->capacity) {
+        int newCapacity = map->capacity ? map->capacity * 2 : INLINE_EXTENTS;
+        Extent *grown = realloc(map->extents, sizeof(Extent) * newCapacity);
+        if (grown == NULL) {
+            return -1; // failure (out of memory)
+        }
+        map->extents = grown;
+        map->capacity = newCapacity;
+    }
+    map->extents[map->count].start = start;
+    map->extents[map->count].length = length;
+    map->count++;
+    map->numBlocks += length;
+    return 0;
+}
+
+static int appendIndirect(ExtentMap *map, int bNum) {
+    int *grown = realloc(map->indirect, sizeof(int) * (map->numIndirect + 1));
+    if (grown == NULL) {
+        return -1; // failure (out of memory)
+    }
+    map->indirect = grown;
+    map->indirect[map->numIndirect++] = bNum;
+    return 0;
+}
+
+int extentMapLoad(BlockCache *cache, char *inode, ExtentMap *map) {
+    extentMapInit(map);
+
+    if (inode[_INODE_FORMAT] < 2) {
+        // original inode: one contiguous run described by single byte fields
+        int size = (unsigned char)inode[_SIZE];
+        int numBlocks = (unsigned char)inode[_NUM_BLOCKS];
+        if (numBlocks == 0 && size > 0) {
+            numBlocks = (size + DATA_BLOCK_PAYLOAD - 1) / DATA_BLOCK_PAYLOAD; // written before _NUM_BLOCKS existed
+        }
+        return appendExtent(map, (unsigned char)inode[_DATA_BLOCK], numBlocks);
+    }
+
+    int count = getField(inode, _NUM_EXTENTS);
+    for (int i = 0; i < count && i < INLINE_EXTENTS; i++) {
+        int offset = _EXTENTS + i * 8;
+        if (appendExtent(map, getField(inode, offset), getField(inode, offset + 4)) != 0) {
+            extentMapDestroy(map);
+            return -1;
+        }
+    }
+
+    char block[BLOCKSIZE];
+    int remaining = count - INLINE_EXTENTS;
+    for (int bNum = getField(inode, _INDIRECT_BLOCK); bNum > 0 && remaining > 0; bNum = getField(block, _NEXT_INDIRECT)) {
+        if (cacheReadBlock(cache, bNum, block) != 0 || appendIndirect(map, bNum) != 0) {
+            extentMapDestroy(map);
+            return -1; // failure (unable to read indirect extent block)
+        }
+        for (int i = 0; i < EXTENTS_PER_INDIRECT && remaining > 0; i++, remaining--) {
+            int offset = _INDIRECT_EXTENTS + i * 8;
+            if (appendExtent(map, getField(block, offset), getField(block, offset + 4)) != 0) {
+                extentMapDestroy(map);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int extentMapStore(BlockCache *cache, Bitmap *freeMap, char *inode, ExtentMap *map) {
+    int overflow = map->count > INLINE_EXTENTS ? map->count - INLINE_EXTENTS : 0;
+    int needIndirect = (overflow + EXTENTS_PER_INDIRECT - 1) / EXTENTS_PER_INDIRECT;
+
+    // resize the indirect chain, reusing the blocks it already has
+    while (map->numIndirect < needIndirect) {
+        int bNum = bitmapFindRun(freeMap, 1, 1);
+        if (bNum == -1) {
+            return -1; // failure (no block left for the extent list)
+        }
+        bitmapSet(freeMap, bNum, 1);
+        if (appendIndirect(map, bNum) != 0) {
+            bitmapClear(freeMap, bNum, 1);
+            return -1;
+        }
+    }
+    while (map->numIndirect > needIndirect) {
+        bitmapClear(freeMap, map->indirect[--map->numIndirect], 1);
+    }
+
+    char block[BLOCKSIZE];
+    for (int b = 0; b < needIndirect; b++) {
+        memset(block, 0, BLOCKSIZE);
+        block[_BLOCK_TYPE] = 6; // indirect extent block type
+        block[_MAGIC_NUMBER] = 0x44;
+        setField(block, _NEXT_INDIRECT, b + 1 < needIndirect ? map->indirect[b + 1] : 0);
+        for (int i = 0; i < EXTENTS_PER_INDIRECT; i++) {
+            int e = INLINE_EXTENTS + b * EXTENTS_PER_INDIRECT + i;
+            if (e >= map->count) {
+                break;
+            }
+            setField(block, _INDIRECT_EXTENTS + i * 8, map->extents[e].start);
+            setField(block, _INDIRECT_EXTENTS + i * 8 + 4, map->extents[e].length);
+        }
+        if (cacheWriteBlock(cache, map->indirect[b], block) != 0) {
+            return -1; // failure (unable to write indirect extent block)
+        }
+    }
+
+    if (inode[_INODE_FORMAT] < 2) {
+        setInodeSize(inode, (unsigned char)inode[_SIZE]); // widen the size before the int fields overwrite it
+    }
+    memset(&inode[_EXTENTS], 0, INLINE_EXTENTS * 8);
+    for (int i = 0; i < map->count && i < INLINE_EXTENTS; i++) {
+        setField(inode, _EXTENTS + i * 8, map->extents[i].start);
+        setField(inode, _EXTENTS + i * 8 + 4, map->extents[i].length);
+    }
+    setField(inode, _NUM_EXTENTS, map->count);
+    setField(inode, _INDIRECT_BLOCK, needIndirect > 0 ? map->indirect[0] : 0);
+    setField(inode, _DATA_BLOCK, map->count > 0 ? map->extents[0].start : -1);
+    setField(inode, _NUM_BLOCKS, map->numBlocks);
+    return 0;
+}
+
+int extentMapLookup(ExtentMap *map, int fileBlock, int *run) {
+    for (int i = 0; i < map->count; i++) {
+        if (fileBlock < map->extents[i].length) {
+            *run = map->extents[i].length - fileBlock;
+            return map->extents[i].start + fileBlock;
+        }
+        fileBlock -= map->extents[i].length;
+    }
+    return -1; // past the end of the file's blocks
+}
+
+int extentMapGrow(ExtentMap *map, Bitmap *freeMap, int count) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (count > freeMap->nFree) {
+        return -1; // failure (not enough free blocks)
+    }
+    int oldBlocks = map->numBlocks;
+
+    // 1. extend the last extent in place
+    if (map->count > 0) {
+        Extent *last = &map->extents[map->count - 1];
+        int n = 0;
+        if (bitmapFindFree(freeMap, last->start + last->length, count, &n) == last->start + last->length) {
+            bitmapSet(freeMap, last->start + last->length, n);
+            last->length += n;
+            map->numBlocks += n;
+            count -= n;
+        }
+    }
+
+    // 2. one new extent for everything that is left, if such a run exists
+    if (count > 0) {
+        int start = bitmapFindRun(freeMap, count, 1);
+        if (start != -1) {
+            bitmapSet(freeMap, start, count);
+            if (appendExtent(map, start, count) != 0) {
+                bitmapClear(freeMap, start, count);
+                extentMapTruncate(map, freeMap, oldBlocks);
+                return -1;
+            }
+            count = 0;
+        }
+    }
+
+    // 3. free space is fragmented, take the first free runs until the request is covered
+    while (count > 0) {
+        int n = 0;
+        int start = bitmapFindFree(freeMap, 1, count, &n);
+        if (start == -1 || appendExtent(map, start, n) != 0) {
+            extentMapTruncate(map, freeMap, oldBlocks);
+            return -1; // failure (ran out of space or memory)
+        }
+        bitmapSet(freeMap, start, n);
+        count -= n;
+    }
+    return 0;
+}
+
+void extentMapTruncate(ExtentMap *map, Bitmap *freeMap, int nBlocks) {
+    int kept = 0;
+    int i = 0;
+    while (i < map->count && kept + map->extents[i].length <= nBlocks) {
+        kept += map->extents[i].length;
+        i++;
+    }
+    if (i < map->count && kept < nBlocks) {
+        // extent straddles the cut, keep its front part
+        Extent *e = &map->extents[i];
+        int keep = nBlocks - kept;
+        bitmapClear(freeMap, e->start + keep, e->length - keep);
+        e->length = keep;
+        kept = nBlocks;
+        i++;
+    }
+    for (int j = i; j < map->count; j++) {
+        bitmapClear(freeMap, map->extents[j].start, map->extents[j].length);
+    }
+    map->count = i;
+    map->numBlocks = kept;
+}
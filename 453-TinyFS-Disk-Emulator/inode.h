@@ -0,0 +1,47 @@
+#ifndef INODE_H
+#define INODE_H
+
+#include "blockCache.h"
+#include "bitmap.h"
+
+// multi-byte fields inside superblock, inode and other metadata blocks.
+// always 32-bit little-endian on disk, whatever the host byte order
+int getField(char *block, int offset);
+void setField(char *block, int offset, int value);
+
+// file size recorded in an inode block, either inode format
+int getInodeSize(char *inode);
+void setInodeSize(char *inode, int size); // also upgrades the inode to the extent format
+
+typedef struct {
+    int start;  // first disk block of the extent
+    int length; // number of blocks in the extent
+} Extent;
+
+// in-memory copy of a file's whole extent list, inline and indirect parts together
+typedef struct {
+    Extent *extents;
+    int count;
+    int capacity;
+    int *indirect; // indirect extent blocks currently holding the list, in chain order
+    int numIndirect;
+    int numBlocks; // total data blocks covered by the extents
+} ExtentMap;
+
+void extentMapInit(ExtentMap *map);
+void extentMapDestroy(ExtentMap *map);
+
+// read the extent list of inode, following the indirect chain through cache
+int extentMapLoad(BlockCache *cache, char *inode, ExtentMap *map);
+// write the list back: inline extents into inode, the rest into indirect blocks,
+// which are allocated from / returned to freeMap as the chain grows or shrinks
+int extentMapStore(BlockCache *cache, Bitmap *freeMap, char *inode, ExtentMap *map);
+
+// disk block holding file block fileBlock, *run = contiguous blocks from there
+int extentMapLookup(ExtentMap *map, int fileBlock, int *run);
+// allocate count more blocks at the end of the file, extending the last extent when possible
+int extentMapGrow(ExtentMap *map, Bitmap *freeMap, int count);
+// keep the first nBlocks blocks, free the rest
+void extentMapTruncate(ExtentMap *map, Bitmap *freeMap, int nBlocks);
+
+#endif
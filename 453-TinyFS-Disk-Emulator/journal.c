@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libDisk.h"
+#include "checksum.h"
+#include "journal.h"
+#include "inode.h"
+#include "tinyFS.h"
+#include "tinyLog.h"
+
+struct Journal {
+    int disk;
+    int header;   // disk block of the journal header
+    int nBlocks;  // header included
+    int head;     // journal block the next transaction starts at
+    int sequence; // of the next transaction
+};
+
+// CRC32C over one more block of a transaction
+static unsigned int checksumBlock(unsigned int sum, const char *block) {
+    return crc32c(sum, block, BLOCKSIZE);
+}
+
+// journal blocks a transaction of count images takes: descriptors, images and the commit block
+static int transactionBlocks(int count) {
+    return count + (count + RECORD_TARGETS_PER_BLOCK - 1) / RECORD_TARGETS_PER_BLOCK + 1;
+}
+
+static int writeHeader(Journal *journal) {
+    char block[BLOCKSIZE] = {0};
+    block[_BLOCK_TYPE] = 8; // journal header block type
+    block[_MAGIC_NUMBER] = 0x44;
+    setField(block, _JOURNAL_BLOCKS, journal->nBlocks);
+    setField(block, _JOURNAL_SEQUENCE, journal->sequence);
+    setField(block, _JOURNAL_TAIL, journal->head);
+    return writeBlock(journal->disk, journal->header, block);
+}
+
+int journalFormat(int disk, int header, int nBlocks) {
+    // zeroed records, so nothing left from an earlier file system on the disk is ever replayed
+    int chunk = nBlocks < IO_CHUNK_BLOCKS * 8 ? nBlocks : IO_CHUNK_BLOCKS * 8;
+    char *blocks = calloc(chunk, BLOCKSIZE);
+    if (blocks == NULL) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    int written = 0;
+    for (int done = 0; written == 0 && done < nBlocks; done += chunk) {
+        written = writeBlocks(disk, header + done, nBlocks - done < chunk ? nBlocks - done : chunk, blocks);
+    }
+    free(blocks);
+    Journal journal = {disk, header, nBlocks, 1, 1};
+    if (written != 0 || writeHeader(&journal) != 0) {
+        return TFS_EIO; // failure (unable to write the journal)
+    }
+    return 0;
+}
+
+// check the transaction starting at journal block pos: the journal block after its
+// commit block, or 0 if it is incomplete, torn or not the next in sequence
+static int scanTransaction(Journal *journal, int pos, char *block, char *image) {
+    int start = pos;
+    int totalBlocks = diskBlocks(journal->disk);
+    unsigned int sum = 0;
+    while (pos < journal->nBlocks) {
+        if (readBlock(journal->disk, journal->header + pos, block) != 0 ||
+            block[_MAGIC_NUMBER] != 0x44 || getField(block, _RECORD_SEQUENCE) != journal->sequence) {
+            return 0;
+        }
+        if (block[_BLOCK_TYPE] == 10) {
+            int complete = getField(block, _RECORD_COUNT) == pos - start &&
+                           (unsigned int)getField(block, _RECORD_CHECKSUM) == sum;
+            return complete ? pos + 1 : 0;
+        }
+        int count = getField(block, _RECORD_COUNT);
+        if (block[_BLOCK_TYPE] != 9 || count < 1 || count > RECORD_TARGETS_PER_BLOCK || pos + 1 + count >= journal->nBlocks) {
+            return 0;
+        }
+        sum = checksumBlock(sum, block);
+        for (int i = 0; i < count; i++) {
+            int target = getField(block, _RECORD_TARGETS + 4 * i);
+            if (target < 0 || target >= totalBlocks || readBlock(journal->disk, journal->header + pos + 1 + i, image) != 0) {
+                return 0;
+            }
+            sum = checksumBlock(sum, image);
+        }
+        pos += 1 + count;
+    }
+    return 0;
+}
+
+// write every image of the (checked) transaction at pos to its home location
+static int applyTransaction(Journal *journal, int pos, char *block, char *image) {
+    while (1) {
+        if (readBlock(journal->disk, journal->header + pos, block) != 0) {
+            return TFS_EIO; // failure (unable to read descriptor)
+        }
+        if (block[_BLOCK_TYPE] == 10) {
+            return 0;
+        }
+        int count = getField(block, _RECORD_COUNT);
+        for (int i = 0; i < count; i++) {
+            if (readBlock(journal->disk, journal->header + pos + 1 + i, image) != 0 ||
+                writeBlock(journal->disk, getField(block, _RECORD_TARGETS + 4 * i), image) != 0) {
+                return TFS_EIO; // failure (unable to copy image home)
+            }
+        }
+        pos += 1 + count;
+    }
+}
+
+int journalOpen(int disk, int header, Journal **journal) {
+    *journal = NULL;
+    char block[BLOCKSIZE];
+    if (readBlock(disk, header, block) != 0) {
+        return TFS_EIO; // failure (unable to read journal header)
+    }
+    if (block[_BLOCK_TYPE] != 8 || block[_MAGIC_NUMBER] != 0x44) {
+        return 0; // no journal on this disk
+    }
+    int nBlocks = getField(block, _JOURNAL_BLOCKS);
+    int tail = getField(block, _JOURNAL_TAIL);
+    if (nBlocks < 3 || header + nBlocks > diskBlocks(disk) || tail < 1 || tail >= nBlocks) {
+        return TFS_ECORRUPT; // failure (journal header makes no sense)
+    }
+
+    Journal *opened = malloc(sizeof(Journal));
+    if (opened == NULL) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    opened->disk = disk;
+    opened->header = header;
+    opened->nBlocks = nBlocks;
+    opened->head = tail;
+    opened->sequence = getField(block, _JOURNAL_SEQUENCE);
+
+    // every complete transaction since the last checkpoint, oldest first
+    char image[BLOCKSIZE];
+    int replayed = 0;
+    int next;
+    while ((next = scanTransaction(opened, opened->head, block, image)) != 0) {
+        if (applyTransaction(opened, opened->head, block, image) != 0) {
+            free(opened);
+            return TFS_EIO; // failure (unable to replay)
+        }
+        opened->head = next;
+        opened->sequence++;
+        replayed++;
+    }
+    if (replayed > 0 || tail != 1) {
+        logInfo("Replayed %d journal transactions.\n", replayed);
+        if (journalCheckpoint(opened) != 0) {
+            free(opened);
+            return TFS_EIO; // failure (unable to reset the journal)
+        }
+    }
+    *journal = opened;
+    return 0;
+}
+
+void journalClose(Journal *journal) {
+    free(journal);
+}
+
+int journalCapacity(Journal *journal) {
+    int room = journal->nBlocks - 2; // records after the header, less the commit block
+    return room - (room + RECORD_TARGETS_PER_BLOCK) / (RECORD_TARGETS_PER_BLOCK + 1);
+}
+
+int journalFits(Journal *journal, int count) {
+    return journal->head + transactionBlocks(count) <= journal->nBlocks;
+}
+
+int journalCommit(Journal *journal, int count, int *bNums, char *blocks) {
+    if (count <= 0) {
+        return 0; // nothing to log
+    }
+    int total = transactionBlocks(count);
+    if (journal->head + total > journal->nBlocks) {
+        return TFS_ENOSPC; // failure (checkpoint first, or the transaction is too large)
+    }
+    char *records = calloc(total, BLOCKSIZE);
+    if (records == NULL) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+
+    unsigned int sum = 0;
+    int pos = 0;
+    for (int done = 0; done < count; ) {
+        int n = count - done < RECORD_TARGETS_PER_BLOCK ? count - done : RECORD_TARGETS_PER_BLOCK;
+        char *descriptor = &records[pos * BLOCKSIZE];
+        descriptor[_BLOCK_TYPE] = 9; // journal descriptor block type
+        descriptor[_MAGIC_NUMBER] = 0x44;
+        setField(descriptor, _RECORD_SEQUENCE, journal->sequence);
+        setField(descriptor, _RECORD_COUNT, n);
+        for (int i = 0; i < n; i++) {
+            setField(descriptor, _RECORD_TARGETS + 4 * i, bNums[done + i]);
+        }
+        sum = checksumBlock(sum, descriptor);
+        memcpy(&records[(pos + 1) * BLOCKSIZE], &blocks[(size_t)done * BLOCKSIZE], (size_t)n * BLOCKSIZE);
+        for (int i = 0; i < n; i++) {
+            sum = checksumBlock(sum, &records[(pos + 1 + i) * BLOCKSIZE]);
+        }
+        pos += 1 + n;
+        done += n;
+    }
+    char *commit = &records[pos * BLOCKSIZE];
+    commit[_BLOCK_TYPE] = 10; // journal commit block type
+    commit[_MAGIC_NUMBER] = 0x44;
+    setField(commit, _RECORD_SEQUENCE, journal->sequence);
+    setField(commit, _RECORD_COUNT, pos);
+    setField(commit, _RECORD_CHECKSUM, (int)sum);
+
+    // one write for the whole transaction, one sync to make it durable
+    int result = writeBlocks(journal->disk, journal->header + journal->head, total, records);
+    free(records);
+    if (result != 0 || syncDisk(journal->disk) != 0) {
+        return TFS_EIO; // failure (transaction may or may not replay)
+    }
+    journal->head += total;
+    journal->sequence++;
+    return 0;
+}
+
+int journalCheckpoint(Journal *journal) {
+    // home locations first, then the header that stops them being replayed, both synced
+    // so records written after this can never be mistaken for the old ones
+    if (syncDisk(journal->disk) != 0) {
+        return TFS_EIO; // failure (unable to sync home locations)
+    }
+    journal->head = 1;
+    if (writeHeader(journal) != 0 || syncDisk(journal->disk) != 0) {
+        return TFS_EIO; // failure (unable to write journal header)
+    }
+    return 0;
+}
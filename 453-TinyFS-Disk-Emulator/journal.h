@@ -0,0 +1,24 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// write-ahead journal of metadata blocks on a libDisk disk. a transaction is a set of
+// whole blocks that reaches its home locations all or not at all: journalCommit logs
+// the images and syncs, after that the caller may write them in place without syncing.
+// replaying at open rewrites every transaction logged since the last checkpoint, in order.
+// records are appended until the journal is full, journalCheckpoint then starts it over
+typedef struct Journal Journal;
+
+// lay out an empty journal of nBlocks blocks (header included) starting at block header
+int journalFormat(int disk, int header, int nBlocks);
+// *journal = the journal starting at block header after replaying it, NULL if the disk has none there
+int journalOpen(int disk, int header, Journal **journal);
+void journalClose(Journal *journal);
+
+int journalCapacity(Journal *journal); // most blocks one transaction can log
+int journalFits(Journal *journal, int count); // whether count more blocks fit before a checkpoint is needed
+// log count blocks, bNums[i] gets blocks[i * BLOCKSIZE ...]. durable once it returns 0
+int journalCommit(Journal *journal, int count, int *bNums, char *blocks);
+// everything committed has been written in place: sync it and start the journal over
+int journalCheckpoint(Journal *journal);
+
+#endif
@@ -1,18 +1,54 @@
+#define _DEFAULT_SOURCE // pread/pwrite, preadv/pwritev and ftruncate under -std=c99
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include "libDisk.h"
+#include "TinyFS_errno.h"
+#include "tinyLog.h"
+#include "stats.h"
 
-#define BLOCKSIZE 256
+#define MAX_IOV_BLOCKS 64 // blocks moved per preadv/pwritev call (well under IOV_MAX)
+
+// disks opened with openDiskMapped keep the whole image mapped into memory
+typedef struct {
+    char *base;  // start of the mapping (NULL if the disk is not mapped)
+    size_t size; // bytes mapped, always the image size at open time
+} DiskMap;
+
+static DiskMap *diskMaps = NULL; // indexed by disk number
+static int diskMapsLen = 0;
+static pthread_rwlock_t diskMapsLock = PTHREAD_RWLOCK_INITIALIZER; // the table is grown and changed while other threads do I/O
+
+// copy of disk's mapping in *copy, NULL if the disk is not memory-mapped
+static DiskMap *getMap(int disk, DiskMap *copy) {
+    DiskMap *found = NULL;
+    pthread_rwlock_rdlock(&diskMapsLock);
+    if (disk >= 0 && disk < diskMapsLen && diskMaps[disk].base != NULL) {
+        *copy = diskMaps[disk];
+        found = copy;
+    }
+    pthread_rwlock_unlock(&diskMapsLock);
+    return found;
+}
+
+// address of blocks [startBlock, startBlock + count) inside the mapping
+static char *mappedRange(DiskMap *map, int startBlock, int count) {
+    if (startBlock < 0 || count < 0 || (size_t)(startBlock + count) * BLOCKSIZE > map->size) {
+        return NULL; // range runs past the end of the image
+    }
+    return map->base + (size_t)startBlock * BLOCKSIZE;
+}
 
 int openDisk(char *filename, int nBytes) {
-    //printf("entered func\n");
-    //printf("nBytes: %d, BLOCKSIZE: %d\n", nBytes, BLOCKSIZE);
     if (nBytes < BLOCKSIZE && nBytes != 0) {
-        printf("returning -1\n");   // TODO - Rewrite error codes
-        return -1; // failure (nBytes should be at least BLOCKSIZE) so return neg
+        return TFS_EINVAL; // failure (nBytes should be at least BLOCKSIZE) so return neg
     }
     
     int flags = O_RDWR | O_CREAT;
@@ -22,153 +58,270 @@ int openDisk(char *filename, int nBytes) {
     
     int fd = open(filename, flags, S_IRUSR | S_IWUSR);
     if (fd == -1) {
-        // perror("Failed to open file");
-        return -1; // failure (unable to open file) so return neg
+        logError("Failed to open %s: %s\n", filename, strerror(errno));
+        return TFS_EOPEN; // failure (unable to open file) so return neg
     }
     
     if (nBytes > 0) {
         // truncate the file to the required size
         int diskSize = nBytes - (nBytes % BLOCKSIZE); // adjusting for BLOCKSIZE
-        //printf("diskSize: %d\n", diskSize);
         if (ftruncate(fd, diskSize) == -1) {
-            perror("Failed to truncate file");
+            logError("Failed to truncate %s: %s\n", filename, strerror(errno));
             close(fd);
-            return -1; // failure, so return negative
+            return TFS_EIO; // failure, so return negative
         }
     }
     
     return fd; // success, so return file descriptor as disk number
 }
 
+int openDiskMapped(char *filename, int nBytes) {
+    int disk = openDisk(filename, nBytes); // same sizing rules, so images stay interchangeable
+    if (disk < 0) {
+        return disk;
+    }
+
+    struct stat st;
+    if (fstat(disk, &st) == -1 || st.st_size < BLOCKSIZE) {
+        close(disk);
+        return TFS_EFORMAT; // failure (image too small to hold a block)
+    }
+    size_t size = (size_t)st.st_size - (size_t)st.st_size % BLOCKSIZE;
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, disk, 0);
+    if (base == MAP_FAILED) {
+        logError("Failed to map %s: %s\n", filename, strerror(errno));
+        close(disk);
+        return TFS_EIO; // failure (unable to map file)
+    }
+
+    pthread_rwlock_wrlock(&diskMapsLock);
+    if (disk >= diskMapsLen) {
+        int newLen = disk + 1 > diskMapsLen * 2 ? disk + 1 : diskMapsLen * 2;
+        DiskMap *grown = realloc(diskMaps, sizeof(DiskMap) * newLen);
+        if (grown == NULL) {
+            pthread_rwlock_unlock(&diskMapsLock);
+            munmap(base, size);
+            close(disk);
+            return TFS_ENOMEM;
+        }
+        memset(grown + diskMapsLen, 0, sizeof(DiskMap) * (newLen - diskMapsLen));
+        diskMaps = grown;
+        diskMapsLen = newLen;
+    }
+    diskMaps[disk].base = base;
+    diskMaps[disk].size = size;
+    pthread_rwlock_unlock(&diskMapsLock);
+    return disk; // success, disk number as for openDisk
+}
+
+void *mapBlock(int disk, int bNum) {
+    DiskMap mapCopy;
+    DiskMap *map = getMap(disk, &mapCopy);
+    if (map == NULL) {
+        return NULL; // only mapped disks can hand out block pointers
+    }
+    return mappedRange(map, bNum, 1);
+}
+
+int syncDisk(int disk) {
+    DiskMap mapCopy;
+    DiskMap *map = getMap(disk, &mapCopy);
+    if (map != NULL) {
+        return msync(map->base, map->size, MS_SYNC) == 0 ? 0 : TFS_EIO;
+    }
+    return fsync(disk) == 0 ? 0 : TFS_EIO;
+}
+
 int closeDisk(int disk) {
-    return close(disk); // close the file descriptor
+    DiskMap mapCopy;
+    DiskMap *map = getMap(disk, &mapCopy);
+    if (map != NULL) {
+        pthread_rwlock_wrlock(&diskMapsLock);
+        diskMaps[disk].base = NULL;
+        diskMaps[disk].size = 0;
+        pthread_rwlock_unlock(&diskMapsLock);
+        int synced = msync(map->base, map->size, MS_SYNC);
+        munmap(map->base, map->size);
+        if (synced == -1) {
+            close(disk);
+            return TFS_EIO; // failure (mapped changes could not be flushed)
+        }
+    }
+    return close(disk) == 0 ? 0 : TFS_EIO; // close the file descriptor
+}
+
+// pread/pwrite take the offset as an argument, so block I/O is one syscall per
+// call and never touches the descriptor's shared file offset.
+// a short transfer is retried until the whole range has moved.
+static int preadFull(int disk, char *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(disk, buf, len, offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logError("Failed to read from disk %d: %s\n", disk, strerror(errno));
+            return TFS_EIO; // failure (unable to read from file) so return negative
+        }
+        if (n == 0) {
+            return TFS_EINVAL; // failure (read past the end of the disk) so return negative
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int pwriteFull(int disk, const char *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(disk, buf, len, offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logError("Failed to write to disk %d: %s\n", disk, strerror(errno));
+            return TFS_EIO; // failure (unable to write to file) so return neg
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int readRange(int disk, int startBlock, int count, void *buf) {
+    if (startBlock < 0 || count < 0) {
+        return TFS_EINVAL;
+    }
+    DiskMap mapCopy;
+    DiskMap *map = getMap(disk, &mapCopy);
+    if (map != NULL) {
+        char *src = mappedRange(map, startBlock, count);
+        if (src == NULL) {
+            return TFS_EINVAL;
+        }
+        memcpy(buf, src, (size_t)count * BLOCKSIZE);
+        return 0;
+    }
+    return preadFull(disk, buf, (size_t)count * BLOCKSIZE, (off_t)startBlock * BLOCKSIZE);
+}
+
+static int writeRange(int disk, int startBlock, int count, void *buf) {
+    if (startBlock < 0 || count < 0) {
+        return TFS_EINVAL;
+    }
+    DiskMap mapCopy;
+    DiskMap *map = getMap(disk, &mapCopy);
+    if (map != NULL) {
+        char *dst = mappedRange(map, startBlock, count);
+        if (dst == NULL) {
+            return TFS_EINVAL;
+        }
+        memcpy(dst, buf, (size_t)count * BLOCKSIZE);
+        return 0;
+    }
+    return pwriteFull(disk, buf, (size_t)count * BLOCKSIZE, (off_t)startBlock * BLOCKSIZE);
 }
 
 int readBlock(int disk, int bNum, void *block) {
-    off_t offset = bNum * BLOCKSIZE;
-    if (lseek(disk, offset, SEEK_SET) == -1) {
-        perror("Failed to seek file");
-        return -1; // failure (unable to seek file) so return negative
+    return readBlocks(disk, bNum, 1, block);
+}
+
+int writeBlock(int disk, int bNum, void *block) {
+    return writeBlocks(disk, bNum, 1, block);
+}
+
+int readBlocks(int disk, int startBlock, int count, void *buf) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = readRange(disk, startBlock, count, buf);
+    statsEnd(&span, STAT_DISK_READ, startBlock, result, result == 0 ? (long long)count * BLOCKSIZE : 0, count);
+    return result;
+}
+
+int writeBlocks(int disk, int startBlock, int count, void *buf) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = writeRange(disk, startBlock, count, buf);
+    statsEnd(&span, STAT_DISK_WRITE, startBlock, result, result == 0 ? (long long)count * BLOCKSIZE : 0, count);
+    return result;
+}
+
+// move count contiguous disk blocks to / from count separate buffers with
+// preadv/pwritev, one syscall per MAX_IOV_BLOCKS blocks
+static int transferBlocksv(int disk, int startBlock, int count, void **blocks, int write) {
+    if (startBlock < 0 || count < 0) {
+        return TFS_EINVAL;
     }
-    
-    ssize_t bytesRead = read(disk, block, BLOCKSIZE);
-    if (bytesRead == -1) {
-        perror("Failed to read from file");
-        return -1; // failure (unable to read from file) so return negative
-    } else if (bytesRead < BLOCKSIZE) {
-        return -1; // failure (read fewer bytes than expected) so return negative
+    DiskMap mapCopy;
+    DiskMap *map = getMap(disk, &mapCopy);
+    if (map != NULL) {
+        char *base = mappedRange(map, startBlock, count);
+        if (base == NULL) {
+            return TFS_EINVAL;
+        }
+        for (int i = 0; i < count; i++) {
+            if (write) {
+                memcpy(base + (size_t)i * BLOCKSIZE, blocks[i], BLOCKSIZE);
+            } else {
+                memcpy(blocks[i], base + (size_t)i * BLOCKSIZE, BLOCKSIZE);
+            }
+        }
+        return 0;
+    }
+    struct iovec iov[MAX_IOV_BLOCKS];
+    while (count > 0) {
+        int n = count < MAX_IOV_BLOCKS ? count : MAX_IOV_BLOCKS;
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = blocks[i];
+            iov[i].iov_len = BLOCKSIZE;
+        }
+        off_t offset = (off_t)startBlock * BLOCKSIZE;
+        ssize_t done = write ? pwritev(disk, iov, n, offset) : preadv(disk, iov, n, offset);
+        if (done == -1 && errno == EINTR) {
+            continue;
+        }
+        if (done != (ssize_t)n * BLOCKSIZE) {
+            // partial transfer (or error), finish the run one block at a time
+            for (int i = 0; i < n; i++) {
+                int r = write ? pwriteFull(disk, blocks[i], BLOCKSIZE, offset + (off_t)i * BLOCKSIZE)
+                              : preadFull(disk, blocks[i], BLOCKSIZE, offset + (off_t)i * BLOCKSIZE);
+                if (r != 0) {
+                    return r;
+                }
+            }
+        }
+        startBlock += n;
+        blocks += n;
+        count -= n;
     }
-    
     return 0; // success
 }
 
-int writeBlock(int disk, int bNum, void *block) {
-    //printf("entered writeblock() with fd %d\n", disk);
-    //printf("entered writeBlock()\n");
-    off_t offset = bNum * BLOCKSIZE;
-    //printf("offest: %lld\n", offset);
-    if (lseek(disk, offset, SEEK_SET) == -1) {
-        perror("Failed to seek file");
-        return -1; // failure (unable to seek file) so return neg
+int diskBlocks(int disk) {
+    struct stat st;
+    if (fstat(disk, &st) != 0) {
+        return -1; // failure (not an open disk)
     }
+    if (st.st_size / BLOCKSIZE > 0x7fffffff) {
+        return 0x7fffffff; // block numbers are 32-bit
+    }
+    return (int)(st.st_size / BLOCKSIZE);
+}
 
-    //char* data = block;
-    
-    //printf("about to call write() with disk %d, BLOCKSIZE %d\n", disk, BLOCKSIZE);
-    // for(int i = 0; i < 256; i++) {
-    //     printf("%c\n", data[i]);
-    // }
-    
-    ssize_t bytesWritten = write(disk, block, BLOCKSIZE);
-    //printf("succefully did write()\n");
-    if (bytesWritten == -1) {
-        perror("Failed to write to file");
-        return -1; // failure (unable to write to file) so return neg
-    } else if (bytesWritten < BLOCKSIZE) {
-        return -1; // failure (wrote fewer bytes than expected) so return neg
-    }
-    printf("exiting writeBlock() with disk = %d\n", disk);
-    //printf("exiting writeblock() with success\n");
-    return 0; // success
+int readBlocksv(int disk, int startBlock, int count, void **blocks) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = transferBlocksv(disk, startBlock, count, blocks, 0);
+    statsEnd(&span, STAT_DISK_READ, startBlock, result, result == 0 ? (long long)count * BLOCKSIZE : 0, count);
+    return result;
 }
 
-// -----------------------------------
-// BELOW IS FOR TESTING
-// -----------------------------------
-
-// int main() {
-//     char* filename = "hello.txt";
-
-//     //Test 1: Bad # bytes
-//     int nBytes = 5;
-//     int res = openDisk(filename, nBytes);
-//     printf("Test 1 (Open File) Result: %d\n", res);
-
-//     //Test 2: Base # Bytes + writing/reading
-//     nBytes = 256;
-//     res = openDisk(filename, nBytes);
-//     printf("Test 2 (Open File) Result: %d\n", res);
-//     int blockNum = 0;
-//     char data[BLOCKSIZE] = "Hello, world!";
-//     int writeRes = writeBlock(res, blockNum, data);
-//     if (writeRes == 0) {
-//         printf("Data written successfully to block %d\n", blockNum);
-//     } else {
-//         printf("Failed to write data to block %d\n", blockNum);
-//     }
-//     char readData[BLOCKSIZE];
-//     int readRes = readBlock(res, blockNum, readData);
-//     if (readRes == 0) {
-//         printf("Data read successfully from block %d\n", blockNum);
-//     } else {
-//         printf("Failed to read data from block %d\n", blockNum);
-//     }
-//     printf("Data read: %s\n", readData);
-//     int closeRes = closeDisk(res);
-//     printf("Disk closed. Close result: %d\n", closeRes);
-
-//     //Test 3: Rounded-down # bytes
-//     nBytes = 589;
-//     int openRes3 = openDisk(filename, nBytes);
-//     printf("Test 3 (Open File) Result: %d\n", openRes3);
-//     int blockNum1 = 0;
-//     char data3_1[BLOCKSIZE] = "Hello, world!";
-//     int writeRes3 = writeBlock(openRes3, blockNum1, data3_1);
-//     if (writeRes3 == 0) {
-//         printf("Data written successfully to block %d\n", blockNum1);
-//     } else {
-//         printf("Failed to write data to block %d\n", blockNum1);
-//     }
-    
-//     int blockNum2 = 1;
-//     char data3_2[BLOCKSIZE] = "This is a new block!";
-//     int writeRes3_1 = writeBlock(openRes3, blockNum2, data3_2);
-//     if (writeRes3_1 == 0) {
-//         printf("Data written successfully to block %d\n", blockNum2);
-//     } else {
-//         printf("Failed to write data to block %d\n", blockNum2);
-//     }
-    
-//     char readData3_1[BLOCKSIZE];
-//     int readRes3_1 = readBlock(openRes3, blockNum1, readData3_1);
-//     if (readRes3_1 == 0) {
-//         printf("Data read successfully from block %d\n", blockNum1);
-//     } else {
-//         printf("Failed to read data from block %d\n", blockNum1);
-//     }
-//     printf("Data read: %s\n", readData3_1);
-
-//     char readData3_2[BLOCKSIZE];
-//     int readRes3_2 = readBlock(openRes3, blockNum2, readData3_2);
-//     if (readRes3_2 == 0) {
-//         printf("Data read successfully from block %d\n", blockNum2);
-//     } else {
-//         printf("Failed to read data from block %d\n", blockNum2);
-//     }
-//     printf("Data read: %s\n", readData3_2);
-
-//     int closeRes3 = closeDisk(openRes3);
-//     printf("Disk closed. Close result: %d\n", closeRes3);
-
-//     return 0;
-// }
\ No newline at end of file
+int writeBlocksv(int disk, int startBlock, int count, void **blocks) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = transferBlocksv(disk, startBlock, count, blocks, 1);
+    statsEnd(&span, STAT_DISK_WRITE, startBlock, result, result == 0 ? (long long)count * BLOCKSIZE : 0, count);
+    return result;
+}
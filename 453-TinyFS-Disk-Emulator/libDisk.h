@@ -3,10 +3,31 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include "TinyFS_errno.h" // failures are returned as these negative codes
 
+// block size of the emulator and of everything built on it. picked at build time
+// (make BLOCKSIZE=4096) so every block copy and parse loop is compiled for a constant size
+#ifndef BLOCKSIZE
 #define BLOCKSIZE 256
+#endif
+#if BLOCKSIZE != 256 && BLOCKSIZE != 512 && BLOCKSIZE != 4096 && BLOCKSIZE != 65536
+#error "BLOCKSIZE must be 256, 512, 4096 or 65536"
+#endif
 
 int openDisk(char *, int);
 int closeDisk(int);
 int readBlock(int, int, void *);
 int writeBlock(int, int, void *);
+
+// multi-block transfers of count contiguous blocks starting at startBlock
+int readBlocks(int disk, int startBlock, int count, void *buf); // buf holds count * BLOCKSIZE bytes
+int writeBlocks(int disk, int startBlock, int count, void *buf);
+int readBlocksv(int disk, int startBlock, int count, void **blocks); // one BLOCKSIZE buffer per block
+int writeBlocksv(int disk, int startBlock, int count, void **blocks);
+
+// memory-mapped mode: the whole image is mmap'd, block I/O becomes memcpy
+int openDiskMapped(char *filename, int nBytes); // same nBytes rules as openDisk
+void *mapBlock(int disk, int bNum); // pointer into the mapping, NULL if disk is not mapped
+int syncDisk(int disk); // msync a mapped disk, fsync otherwise
+
+int diskBlocks(int disk); // number of whole blocks in the disk file, -1 on failure
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "readAhead.h"
+#include "tinyFS.h"
+#include "tinyLog.h"
+
+void readAheadInit(ReadAhead *ra) {
+    memset(ra, 0, sizeof(ReadAhead));
+}
+
+// wait for a buffer's prefetch, a failed or damaged one leaves the buffer empty
+static void settle(ReadAhead *ra, ReadAheadBuffer *buffer) {
+    if (!buffer->inFlight) {
+        return;
+    }
+    if (waitBatch(ra->aio, &buffer->batch) != 0) {
+        logError("Read-ahead of file blocks %d-%d failed.\n", buffer->first, buffer->first + buffer->count - 1);
+        buffer->count = 0;
+    } else if (buffer->sums != NULL && sumsVerify(buffer->sums, buffer->count, buffer->blocks) != 0) {
+        buffer->count = 0;
+    }
+    buffer->inFlight = 0;
+}
+
+void readAheadDrop(ReadAhead *ra) {
+    for (int i = 0; i < 2; i++) {
+        settle(ra, &ra->buffers[i]);
+        free(ra->buffers[i].blocks);
+        free(ra->buffers[i].sums);
+    }
+    readAheadInit(ra);
+}
+
+int readAheadSequential(ReadAhead *ra, int offset) {
+    if (offset != ra->nextOffset) {
+        ra->window = 0; // random access, nothing is prefetched until a stream starts again
+        return 0;
+    }
+    if (ra->window == 0) {
+        ra->window = READ_AHEAD_MIN;
+    }
+    return 1;
+}
+
+// buffer holding fileBlock of this generation (possibly still in flight), or NULL
+static ReadAheadBuffer *holding(ReadAhead *ra, int generation, int fileBlock) {
+    for (int i = 0; i < 2; i++) {
+        ReadAheadBuffer *buffer = &ra->buffers[i];
+        if (buffer->count > 0 && buffer->generation == generation &&
+            fileBlock >= buffer->first && fileBlock < buffer->first + buffer->count) {
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+char *readAheadFind(ReadAhead *ra, int generation, int fileBlock, int *count) {
+    ReadAheadBuffer *buffer = holding(ra, generation, fileBlock);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    settle(ra, buffer);
+    if (buffer->count == 0) {
+        return NULL; // failure (prefetch failed, the caller reads the blocks itself)
+    }
+    *count = buffer->first + buffer->count - fileBlock;
+    return &buffer->blocks[(fileBlock - buffer->first) * BLOCKSIZE];
+}
+
+void readAheadNext(ReadAhead *ra, AsyncDisk *aio, BlockCache *cache, SumTable *sums, ExtentMap *extents,
+                   int generation, int fileBlock, int numBlocks) {
+    if (ra->window == 0) {
+        return;
+    }
+    // the window after the one being read, or right after fileBlock if none is
+    ReadAheadBuffer *current = holding(ra, generation, fileBlock);
+    int start = current != NULL ? current->first + current->count : fileBlock + 1;
+    if (start >= numBlocks || holding(ra, generation, start) != NULL) {
+        return; // end of file, or already on its way
+    }
+
+    ReadAheadBuffer *next = &ra->buffers[current == &ra->buffers[0] ? 1 : 0];
+    settle(ra, next); // its old contents are not wanted, but requests may still point into it
+    int count = numBlocks - start < ra->window ? numBlocks - start : ra->window;
+    if (next->capacity < count) {
+        char *grown = realloc(next->blocks, (size_t)count * BLOCKSIZE);
+        if (grown != NULL) {
+            next->blocks = grown;
+        }
+        unsigned int *grownSums = sums != NULL ? realloc(next->sums, count * sizeof(unsigned int)) : next->sums;
+        if (grownSums != NULL) {
+            next->sums = grownSums;
+        }
+        if (grown == NULL || (sums != NULL && grownSums == NULL)) {
+            next->count = 0;
+            return; // no memory for the window, reads go to the disk as before
+        }
+        next->capacity = count;
+    }
+    ra->aio = aio;
+    next->first = start;
+    next->generation = generation;
+    batchInit(&next->batch);
+
+    // one request per extent run. runs with a block in the cache are copied from it
+    // now, since a dirty cached block is newer than the disk
+    int queued = 0;
+    while (queued < count) {
+        int run;
+        int diskBlock = extentMapLookup(extents, start + queued, &run);
+        if (diskBlock == -1) {
+            break; // extent list shorter than the file size says
+        }
+        if (run > count - queued) {
+            run = count - queued;
+        }
+        if (run > ASYNC_REQUEST_BLOCKS) {
+            run = ASYNC_REQUEST_BLOCKS;
+        }
+        char *request = &next->blocks[queued * BLOCKSIZE];
+        int result = cacheResident(cache, diskBlock, run)
+            ? cacheReadBlocks(cache, diskBlock, run, request)
+            : submitRead(aio, &next->batch, diskBlock, run, request);
+        if (result != 0) {
+            break; // prefetch only what was queued, the reader fetches the rest itself
+        }
+        if (sums != NULL) {
+            sumTableGet(sums, diskBlock, run, &next->sums[queued]); // what the blocks read now must match
+        }
+        queued += run;
+    }
+    next->count = queued;
+    next->inFlight = 1;
+
+    ra->window = ra->window * 2 < READ_AHEAD_MAX ? ra->window * 2 : READ_AHEAD_MAX;
+}
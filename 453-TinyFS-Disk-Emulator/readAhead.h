@@ -0,0 +1,50 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "asyncDisk.h"
+#include "blockCache.h"
+#include "checksum.h"
+#include "inode.h"
+
+#define READ_AHEAD_MIN 4 // blocks fetched by the first prefetch of a sequential stream
+#define READ_AHEAD_MAX (BLOCKSIZE < 4096 ? 131072 / BLOCKSIZE : 32) // the window stops doubling here
+
+// one window of prefetched data blocks, whole blocks with their headers
+typedef struct {
+    int first;      // file block in blocks[0]
+    int count;      // blocks held, 0 = empty
+    int generation; // OpenFile generation the blocks were read at
+    int inFlight;   // batch not waited for yet
+    AsyncBatch batch;
+    char *blocks;
+    unsigned int *sums; // checksums the blocks must match, NULL if the disk keeps none
+    int capacity;   // blocks room was allocated for
+} ReadAheadBuffer;
+
+// sequential read-ahead of one descriptor. while reads keep starting where the last
+// one ended, the next window of blocks is read asynchronously before it is asked for:
+// when the reader enters a window the one after it is submitted, and the window doubles
+// from READ_AHEAD_MIN up to READ_AHEAD_MAX. a read anywhere else shrinks it back.
+// like the descriptor, it is used by one thread at a time
+typedef struct {
+    int nextOffset; // where a sequential read starts
+    int window;     // blocks the next prefetch asks for
+    AsyncDisk *aio; // disk the buffers were read from
+    ReadAheadBuffer buffers[2]; // the window being read and the one after it
+} ReadAhead;
+
+void readAheadInit(ReadAhead *ra);
+void readAheadDrop(ReadAhead *ra); // waits for prefetches still in flight, frees the buffers
+
+// whether a read at offset continues the stream, adjusting the window either way
+int readAheadSequential(ReadAhead *ra, int offset);
+// prefetched copy of fileBlock (waiting for it if it is still in flight), NULL if there is
+// none for this generation. *count = consecutive blocks available from there
+char *readAheadFind(ReadAhead *ra, int generation, int fileBlock, int *count);
+// the reader is at fileBlock of a file with numBlocks data blocks: submit the next
+// window if it is not already on its way. with sums, a window that does not match
+// them is dropped, the reader then reads those blocks (and finds the damage) itself
+void readAheadNext(ReadAhead *ra, AsyncDisk *aio, BlockCache *cache, SumTable *sums, ExtentMap *extents,
+                   int generation, int fileBlock, int numBlocks);
+
+#endif
@@ -0,0 +1,171 @@
+#define _DEFAULT_SOURCE // clock_gettime under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "TinyFS_errno.h"
+#include "stats.h"
+
+static TinyFSStats counters; // updated with atomic adds, calls on any thread land here
+
+// trace ring, records[next % capacity] is overwritten next
+static TraceRecord *traceRecords = NULL;
+static unsigned long long traceCapacity = 0;
+static unsigned long long traceNext = 0;
+
+static const char *statNames[STAT_OPS] = {
+    "mkfs", "mount", "unmount", "sync", "open", "close", "write", "delete", "read",
+    "read_byte", "seek", "disk_read", "disk_write", "dir_rebuild", "freemap_store",
+    "commit", "compress"
+};
+
+#if STATS
+#define ADD(field, value) __atomic_fetch_add(&(field), (value), __ATOMIC_RELAXED)
+
+// blocks and cache hits / misses counted on this thread so far, spans take differences
+static __thread unsigned long long threadBlocks, threadHits, threadMisses;
+
+unsigned long long statsNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void statsBegin(StatsSpan *span) {
+    span->blocks = threadBlocks;
+    span->hits = threadHits;
+    span->misses = threadMisses;
+    span->start = statsNow();
+}
+
+void statsEnd(StatsSpan *span, int op, int arg, int result, long long bytes, int blocks) {
+    unsigned long long nanos = statsNow() - span->start;
+    unsigned long long touched = threadBlocks - span->blocks + (blocks > 0 ? blocks : 0);
+    unsigned long long hits = threadHits - span->hits;
+    unsigned long long misses = threadMisses - span->misses;
+    if (bytes < 0) {
+        bytes = 0;
+    }
+
+    OpStats *s = &counters.ops[op];
+    ADD(s->calls, 1);
+    if (result < 0) {
+        ADD(s->errors, 1);
+    }
+    ADD(s->bytes, (unsigned long long)bytes);
+    ADD(s->blocks, touched);
+    ADD(s->cacheHits, hits);
+    ADD(s->cacheMisses, misses);
+    ADD(s->nanos, nanos);
+    int bucket = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+    ADD(s->latency[bucket < STATS_LATENCY_BUCKETS ? bucket : STATS_LATENCY_BUCKETS - 1], 1);
+
+    TraceRecord *ring = __atomic_load_n(&traceRecords, __ATOMIC_ACQUIRE);
+    if (ring != NULL) {
+        TraceRecord *r = &ring[ADD(traceNext, 1) % traceCapacity];
+        r->start = span->start;
+        r->nanos = nanos > 0xffffffffull ? 0xffffffffu : (unsigned int)nanos;
+        r->op = (unsigned short)op;
+        r->result = (short)(result < -32768 ? -32768 : result > 32767 ? 32767 : result);
+        r->arg = arg;
+        r->bytes = (unsigned int)bytes;
+        r->blocks = (unsigned int)touched;
+        r->cacheMisses = (unsigned int)misses;
+    }
+}
+
+void statsCacheAccess(int blocks, int hits, int misses) {
+    threadBlocks += blocks;
+    threadHits += hits;
+    threadMisses += misses;
+}
+#endif
+
+int tfs_stats(TinyFSStats *stats) {
+    if (stats == NULL) {
+        return TFS_EINVAL;
+    }
+    // field by field, so every counter is read whole while other threads keep adding
+    unsigned long long *src = (unsigned long long *)&counters;
+    unsigned long long *dst = (unsigned long long *)stats;
+    for (size_t i = 0; i < sizeof(TinyFSStats) / sizeof(unsigned long long); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+void tfs_statsReset(void) {
+    unsigned long long *c = (unsigned long long *)&counters;
+    for (size_t i = 0; i < sizeof(TinyFSStats) / sizeof(unsigned long long); i++) {
+        __atomic_store_n(&c[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+const char *tfs_statName(int op) {
+    if (op < 0 || op >= STAT_OPS) {
+        return "unknown";
+    }
+    return statNames[op];
+}
+
+unsigned long long tfs_statPercentile(const OpStats *op, int percent) {
+    if (op == NULL || op->calls == 0) {
+        return 0;
+    }
+    unsigned long long total = 0;
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        total += op->latency[i];
+    }
+    unsigned long long wanted = (total * percent + 99) / 100; // calls at or below the answer
+    unsigned long long seen = 0;
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        seen += op->latency[i];
+        if (seen >= wanted && seen > 0) {
+            return 2ull << i; // upper end of bucket i
+        }
+    }
+    return 2ull << (STATS_LATENCY_BUCKETS - 1);
+}
+
+int tfs_traceStart(int nRecords) {
+    if (nRecords <= 0) {
+        return TFS_EINVAL;
+    }
+    TraceRecord *ring = calloc(nRecords, sizeof(TraceRecord));
+    if (ring == NULL) {
+        return TFS_ENOMEM;
+    }
+    tfs_traceStop();
+    traceCapacity = nRecords;
+    traceNext = 0;
+    __atomic_store_n(&traceRecords, ring, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void tfs_traceStop(void) {
+    TraceRecord *ring = __atomic_exchange_n(&traceRecords, NULL, __ATOMIC_ACQ_REL);
+    free(ring);
+    traceCapacity = 0;
+}
+
+int tfs_traceDump(char *filename) {
+    TraceRecord *ring = __atomic_load_n(&traceRecords, __ATOMIC_ACQUIRE);
+    if (ring == NULL) {
+        return TFS_EINVAL; // failure (tracing is not on)
+    }
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        return TFS_EOPEN;
+    }
+    unsigned long long next = __atomic_load_n(&traceNext, __ATOMIC_ACQUIRE);
+    unsigned long long count = next < traceCapacity ? next : traceCapacity;
+    TraceHeader header = {{'T', 'F', 'S', 'T'}, 1, sizeof(TraceRecord), (unsigned int)count};
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    // oldest record first: once the ring has wrapped it sits at next % capacity
+    for (unsigned long long i = next - count; ok && i < next; i++) {
+        ok = fwrite(&ring[i % traceCapacity], sizeof(TraceRecord), 1, f) == 1;
+    }
+    if (fclose(f) != 0 || !ok) {
+        return TFS_EIO;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef STATS_H
+#define STATS_H
+
+// per operation counters, latency histograms and an optional trace ring buffer.
+// the numbers are process wide, summed over every mounted disk. a build with
+// STATS=0 (make STATS=0) compiles all recording out and tfs_stats reports zeros.
+#ifndef STATS
+#define STATS 1
+#endif
+
+// operations that are counted: the public file system calls, then libDisk, then
+// internal metadata work that can make a single call slow. traces record these
+// numbers, so new operations are added at the end
+enum {
+    STAT_MKFS,
+    STAT_MOUNT,
+    STAT_UNMOUNT,
+    STAT_SYNC,
+    STAT_OPEN,
+    STAT_CLOSE,
+    STAT_WRITE,
+    STAT_DELETE,
+    STAT_READ,
+    STAT_READ_BYTE,
+    STAT_SEEK,
+    STAT_DISK_READ,   // readBlock, readBlocks, readBlocksv
+    STAT_DISK_WRITE,  // writeBlock, writeBlocks, writeBlocksv
+    STAT_DIR_REBUILD, // directory rebuilt by scanning every inode block
+    STAT_FREEMAP_STORE, // free-block bitmap written back to the superblock
+    STAT_COMMIT,      // one group commit flush, shared by every change it covers
+    STAT_COMPRESS,    // tfs_setCompression, the file rewritten in its new form
+    STAT_OPS
+};
+
+#define STATS_LATENCY_BUCKETS 40 // bucket i counts calls that took [2^i, 2^(i+1)) ns
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long errors;       // calls that returned a negative code
+    unsigned long long bytes;        // bytes moved (file data, or disk data for libDisk)
+    unsigned long long blocks;       // blocks touched through the cache or the mapping
+    unsigned long long cacheHits;    // of those blocks, found in the block cache
+    unsigned long long cacheMisses;  // of those blocks, fetched from / sent to libDisk
+    unsigned long long nanos;        // total time spent
+    unsigned long long latency[STATS_LATENCY_BUCKETS];
+} OpStats;
+
+typedef struct {
+    OpStats ops[STAT_OPS];
+} TinyFSStats;
+
+int tfs_stats(TinyFSStats *stats); // copy of the counters so far
+void tfs_statsReset(void);
+const char *tfs_statName(int op); // short name of a STAT_* value, e.g. "write"
+unsigned long long tfs_statPercentile(const OpStats *op, int percent); // latency upper bound in ns
+
+// binary trace of every counted call, kept in a ring of the last nRecords calls.
+// tfs_traceDump writes a TraceHeader followed by the records, oldest first, in host
+// byte order. starting and stopping must not overlap other calls
+typedef struct {
+    char magic[4];          // "TFST"
+    unsigned int version;   // 1
+    unsigned int recordSize; // sizeof(TraceRecord)
+    unsigned int count;     // records that follow
+} TraceHeader;
+
+typedef struct {
+    unsigned long long start; // CLOCK_MONOTONIC ns when the call began
+    unsigned int nanos;       // duration, saturated at 2^32 - 1
+    unsigned short op;        // STAT_* value
+    short result;             // return code, clamped to a short
+    int arg;                  // descriptor for file calls, first block for libDisk calls
+    unsigned int bytes;
+    unsigned int blocks;
+    unsigned int cacheMisses;
+} TraceRecord;
+
+int tfs_traceStart(int nRecords);
+int tfs_traceDump(char *filename);
+void tfs_traceStop(void);
+
+// recording, used by the modules. a span brackets one call: blocks and cache
+// hits / misses counted on the same thread while it is open are charged to it
+typedef struct {
+    unsigned long long start;
+    unsigned long long blocks, hits, misses;
+} StatsSpan;
+
+#if STATS
+void statsBegin(StatsSpan *span);
+void statsEnd(StatsSpan *span, int op, int arg, int result, long long bytes, int blocks);
+void statsCacheAccess(int blocks, int hits, int misses);
+unsigned long long statsNow(void); // clock spans use, for calls that finish on another thread
+#else
+// empty, so the arguments still count as used and the calls compile to nothing
+static inline void statsBegin(StatsSpan *span) { (void)span; }
+static inline void statsEnd(StatsSpan *span, int op, int arg, int result, long long bytes, int blocks) {
+    (void)span; (void)op; (void)arg; (void)result; (void)bytes; (void)blocks;
+}
+static inline void statsCacheAccess(int blocks, int hits, int misses) { (void)blocks; (void)hits; (void)misses; }
+static inline unsigned long long statsNow(void) { return 0; }
+#endif
+
+#endif
@@ -8,7 +8,8 @@ int main() {
     tfs_mount("test1.txt");
 
     // by now, should have created 4 block disk w superblock as block 0
-    int disk = tfs_get_mounted_disk();
+    tfs_unmount();
+    int disk = openDisk("test1.txt", 0);
     char block[256];
     readBlock(disk, 0, &block);  // reaed superblock
     if (block[0] != 1) {
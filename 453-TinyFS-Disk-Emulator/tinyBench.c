@@ -0,0 +1,370 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, dup and fdopen under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tinyFS.h"
+#include "libDisk.h"
+
+// micro benchmarks for libDisk and TinyFS. every benchmark prints one CSV line
+// (header first) so runs can be diffed or loaded into a spreadsheet:
+//   name,ops,bytes,seconds,ops_per_sec,mb_per_sec,p50_us,p99_us,syscalls
+// syscalls is the number of read/write family syscalls the process made while
+// the benchmark ran, taken from /proc/self/io (-1 where that file is missing).
+//
+// usage: tinyBench [-m] [-c] [-z] [disk file]   (-m mounts the image mmap'd, -c formats it with block checksums,
+//                                               -z stores the read benchmarks' file compressed)
+
+#define BENCH_DISK "benchDisk.dsk"
+#define BENCH_DISK_SIZE (4096 * 1024) // bytes of the image most benchmarks run on
+#define RAW_BLOCKS 4096 // blocks touched by the raw readBlock/writeBlock runs
+#define MKFS_RUNS 20
+#define FILE_SIZE (256 * 1024) // bytes of the file the read benchmarks use
+#define BULK_CHUNK 4096 // bytes per tfs_readFile call in the bulk benchmarks
+#define RANDOM_OPS 20000
+#define REWRITE_SIZE (64 * 1024)
+#define REWRITE_RUNS 200
+
+static FILE *out; // results, anything else written to stdout goes to /dev/null
+static char *diskName = BENCH_DISK;
+static int mapped = 0;
+static int compression = COMPRESS_NONE; // of the file the read benchmarks use
+
+// one benchmark in progress
+typedef struct {
+    const char *name;
+    double *lat; // per op latency in seconds
+    int ops;
+    int capacity;
+    long long bytes;
+    struct timespec start;
+    long long syscallsAtStart;
+} Bench;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// read + write syscalls made so far, -1 if the kernel does not expose them
+static long long syscallCount(void) {
+    FILE *f = fopen("/proc/self/io", "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char key[32];
+    long long value, total = 0;
+    while (fscanf(f, "%31s %lld", key, &value) == 2) {
+        if (strcmp(key, "syscr:") == 0 || strcmp(key, "syscw:") == 0) {
+            total += value;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+static void benchStart(Bench *b, const char *name, int capacity) {
+    b->name = name;
+    b->capacity = capacity;
+    b->lat = malloc(sizeof(double) * capacity);
+    b->ops = 0;
+    b->bytes = 0;
+    fflush(stdout);
+    b->syscallsAtStart = syscallCount();
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void benchOp(Bench *b, double seconds, int bytes) {
+    if (b->ops < b->capacity) {
+        b->lat[b->ops++] = seconds;
+    }
+    b->bytes += bytes;
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(Bench *b, int p) {
+    if (b->ops == 0) {
+        return 0;
+    }
+    int i = (int)((long long)(b->ops - 1) * p / 100);
+    return b->lat[i];
+}
+
+static void benchEnd(Bench *b) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fflush(stdout); // count the syscalls of buffered TinyFS messages against this run
+    long long syscalls = syscallCount();
+    // each syscallCount() itself costs a few reads, leave them out
+    static long long probeCost = -1;
+    if (probeCost < 0) {
+        long long a = syscallCount();
+        probeCost = syscallCount() - a;
+    }
+    if (syscalls >= 0 && b->syscallsAtStart >= 0) {
+        syscalls -= b->syscallsAtStart + probeCost;
+    } else {
+        syscalls = -1;
+    }
+    double seconds = (end.tv_sec - b->start.tv_sec) + (end.tv_nsec - b->start.tv_nsec) / 1e9;
+    qsort(b->lat, b->ops, sizeof(double), compareDouble);
+    fprintf(out, "%s,%d,%lld,%.6f,%.1f,%.2f,%.2f,%.2f,%lld\n", b->name, b->ops, b->bytes, seconds,
+            seconds > 0 ? b->ops / seconds : 0, seconds > 0 ? b->bytes / seconds / (1024 * 1024) : 0,
+            percentile(b, 50) * 1e6, percentile(b, 99) * 1e6, syscalls);
+    fflush(out);
+    free(b->lat);
+}
+
+static int mountBench(void) {
+    return mapped ? tfs_mountMapped(diskName) : tfs_mount(diskName);
+}
+
+static void fail(const char *what) {
+    fprintf(stderr, "tinyBench: %s failed\n", what);
+    exit(1);
+}
+
+static void benchRawBlocks(void) {
+    char block[BLOCKSIZE];
+    int disk = openDisk(diskName, RAW_BLOCKS * BLOCKSIZE);
+    if (disk < 0) {
+        fail("openDisk");
+    }
+    memset(block, 'x', BLOCKSIZE);
+
+    Bench b;
+    benchStart(&b, "raw_write_block_seq", RAW_BLOCKS);
+    for (int i = 0; i < RAW_BLOCKS; i++) {
+        double t = now();
+        if (writeBlock(disk, i, block) < 0) {
+            fail("writeBlock");
+        }
+        benchOp(&b, now() - t, BLOCKSIZE);
+    }
+    benchEnd(&b);
+
+    benchStart(&b, "raw_read_block_seq", RAW_BLOCKS);
+    for (int i = 0; i < RAW_BLOCKS; i++) {
+        double t = now();
+        if (readBlock(disk, i, block) < 0) {
+            fail("readBlock");
+        }
+        benchOp(&b, now() - t, BLOCKSIZE);
+    }
+    benchEnd(&b);
+
+    benchStart(&b, "raw_read_block_random", RANDOM_OPS);
+    for (int i = 0; i < RANDOM_OPS; i++) {
+        int bNum = rand() % RAW_BLOCKS;
+        double t = now();
+        if (readBlock(disk, bNum, block) < 0) {
+            fail("readBlock");
+        }
+        benchOp(&b, now() - t, BLOCKSIZE);
+    }
+    benchEnd(&b);
+    closeDisk(disk);
+}
+
+static void benchMkfs(void) {
+    Bench b;
+    benchStart(&b, "mkfs", MKFS_RUNS);
+    for (int i = 0; i < MKFS_RUNS; i++) {
+        double t = now();
+        if (tfs_mkfs(diskName, BENCH_DISK_SIZE) < 0) {
+            fail("tfs_mkfs");
+        }
+        benchOp(&b, now() - t, BENCH_DISK_SIZE);
+    }
+    benchEnd(&b);
+}
+
+// create nFiles files on a fresh disk, then open each of them again by name
+static void benchOpen(int nFiles) {
+    char name[16], label[32];
+    if (tfs_mkfs(diskName, BENCH_DISK_SIZE) < 0 || mountBench() < 0) {
+        fail("mount");
+    }
+    Bench b;
+    sprintf(label, "open_create_%d", nFiles);
+    benchStart(&b, label, nFiles);
+    for (int i = 0; i < nFiles; i++) {
+        sprintf(name, "f%d", i);
+        double t = now();
+        fileDescriptor fd = tfs_openFile(name);
+        benchOp(&b, now() - t, 0);
+        if (fd < 0) {
+            fail("tfs_openFile");
+        }
+        tfs_closeFile(fd);
+    }
+    benchEnd(&b);
+
+    sprintf(label, "open_existing_%d", nFiles);
+    benchStart(&b, label, nFiles);
+    for (int i = 0; i < nFiles; i++) {
+        sprintf(name, "f%d", (i * 7919) % nFiles);
+        double t = now();
+        fileDescriptor fd = tfs_openFile(name);
+        benchOp(&b, now() - t, 0);
+        if (fd < 0) {
+            fail("tfs_openFile");
+        }
+        tfs_closeFile(fd);
+    }
+    benchEnd(&b);
+    tfs_unmount();
+}
+
+static void benchRead(void) {
+    char *data = malloc(FILE_SIZE);
+    char buf[BULK_CHUNK];
+    for (int i = 0; i < FILE_SIZE; i++) {
+        data[i] = (char)i;
+    }
+    if (tfs_mkfs(diskName, BENCH_DISK_SIZE) < 0 || mountBench() < 0) {
+        fail("mount");
+    }
+    fileDescriptor fd = tfs_openFile("data");
+    if (fd < 0 || tfs_setCompression(fd, compression) < 0 || tfs_writeFile(fd, data, FILE_SIZE) < 0) {
+        fail("tfs_writeFile");
+    }
+
+    Bench b;
+    tfs_seek(fd, 0);
+    benchStart(&b, "read_byte_seq", FILE_SIZE);
+    for (int i = 0; i < FILE_SIZE; i++) {
+        double t = now();
+        if (tfs_readByte(fd, buf) < 0) {
+            fail("tfs_readByte");
+        }
+        benchOp(&b, now() - t, 1);
+    }
+    benchEnd(&b);
+
+    benchStart(&b, "read_byte_random", RANDOM_OPS);
+    for (int i = 0; i < RANDOM_OPS; i++) {
+        int offset = rand() % FILE_SIZE;
+        double t = now();
+        if (tfs_seek(fd, offset) < 0 || tfs_readByte(fd, buf) < 0) {
+            fail("tfs_readByte");
+        }
+        benchOp(&b, now() - t, 1);
+    }
+    benchEnd(&b);
+
+    tfs_seek(fd, 0);
+    benchStart(&b, "read_bulk_seq", FILE_SIZE / BULK_CHUNK);
+    for (int i = 0; i < FILE_SIZE / BULK_CHUNK; i++) {
+        double t = now();
+        int n = tfs_readFile(fd, buf, BULK_CHUNK);
+        if (n < 0) {
+            fail("tfs_readFile");
+        }
+        benchOp(&b, now() - t, n);
+    }
+    benchEnd(&b);
+
+    benchStart(&b, "read_bulk_random", RANDOM_OPS);
+    for (int i = 0; i < RANDOM_OPS; i++) {
+        int offset = rand() % (FILE_SIZE - BULK_CHUNK);
+        double t = now();
+        int n = -1;
+        if (tfs_seek(fd, offset) == 0) {
+            n = tfs_readFile(fd, buf, BULK_CHUNK);
+        }
+        if (n < 0) {
+            fail("tfs_readFile");
+        }
+        benchOp(&b, now() - t, n);
+    }
+    benchEnd(&b);
+
+    benchStart(&b, "rewrite", REWRITE_RUNS);
+    for (int i = 0; i < REWRITE_RUNS; i++) {
+        double t = now();
+        if (tfs_writeFile(fd, data, REWRITE_SIZE) < 0) {
+            fail("tfs_writeFile");
+        }
+        benchOp(&b, now() - t, REWRITE_SIZE);
+    }
+    benchEnd(&b);
+
+    tfs_closeFile(fd);
+    tfs_unmount();
+    free(data);
+}
+
+// fill the disk with small files until it runs out of space, then delete them all
+static void benchDeleteFull(void) {
+    char name[16], data[4 * BLOCKSIZE];
+    memset(data, 'd', sizeof(data));
+    if (tfs_mkfs(diskName, BENCH_DISK_SIZE) < 0 || mountBench() < 0) {
+        fail("mount");
+    }
+    int capacity = BENCH_DISK_SIZE / BLOCKSIZE;
+    fileDescriptor *fds = malloc(sizeof(fileDescriptor) * capacity);
+    int nFiles = 0;
+    while (nFiles < capacity) {
+        sprintf(name, "d%d", nFiles);
+        fileDescriptor fd = tfs_openFile(name);
+        if (fd < 0) {
+            break;
+        }
+        if (tfs_writeFile(fd, data, sizeof(data)) < 0) {
+            fds[nFiles++] = fd; // the inode exists, delete it with the rest
+            break;
+        }
+        fds[nFiles++] = fd;
+    }
+
+    Bench b;
+    benchStart(&b, "delete_full_disk", nFiles);
+    for (int i = 0; i < nFiles; i++) {
+        double t = now();
+        if (tfs_deleteFile(fds[i]) < 0) {
+            fail("tfs_deleteFile");
+        }
+        benchOp(&b, now() - t, 0);
+    }
+    benchEnd(&b);
+    tfs_unmount();
+    free(fds);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0) {
+            mapped = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            tfs_configureChecksums(CHECKSUM_BLOCK);
+        } else if (strcmp(argv[i], "-z") == 0) {
+            compression = COMPRESS_LZ;
+        } else {
+            diskName = argv[i];
+        }
+    }
+
+    // keep the results on stdout and send everything TinyFS prints to /dev/null
+    out = fdopen(dup(fileno(stdout)), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fail("redirecting stdout");
+    }
+
+    srand(453);
+    fprintf(out, "name,ops,bytes,seconds,ops_per_sec,mb_per_sec,p50_us,p99_us,syscalls\n");
+    benchRawBlocks();
+    benchMkfs();
+    benchOpen(10);
+    benchOpen(100);
+    benchOpen(1000);
+    benchRead();
+    benchDeleteFull();
+    remove(diskName);
+    return 0;
+}
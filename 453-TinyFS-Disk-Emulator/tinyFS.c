@@ -1,522 +1,2125 @@
+#define _DEFAULT_SOURCE // strnlen and clock_gettime under -std=c99
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "libDisk.h" // Include the disk emulator library
+#include "asyncDisk.h"
+#include "bitmap.h"
+#include "checksum.h"
+#include "compress.h"
+#include "inode.h"
+#include "directory.h"
+#include "fileTable.h"
+#include "journal.h"
 #include "tinyFS.h"
+#include "tinyLog.h"
+
+// one mounted disk. everything a tfs call touches hangs off this, so any number of
+// disks can be mounted side by side. the tfs_* calls use defaultFS, the fs_* calls take it as an argument.
+// locking, always taken in this order: txLock, an open file's lock, dirLock, inodeLock, allocLock.
+// the block cache and the file table lock themselves internally, commitLock is innermost
+struct TinyFS {
+    int disk;            // libDisk disk number
+    BlockCache *cache;   // block cache in front of disk, every call goes through it
+    AsyncDisk *async;    // large data reads and writes, NULL on a mapped disk
+    Journal *journal;    // metadata journal, NULL if the disk has none or is mapped
+    SumTable *sums;      // block checksums, NULL if the disk keeps none
+    pthread_rwlock_t txLock; // held shared by calls changing metadata, exclusively by a journaled commit
+    int homeStale;       // blocks of a logged transaction could not be written in place yet
+    int reclaim;         // a call ran out of space with freed blocks held, under allocLock
+    Bitmap freeMap;      // free-block bitmap, written back by fs_sync / fs_unmount
+    Bitmap inodeMap;     // inode map, written back with freeMap
+    int inodeMapBlock;   // first inode map block, 0 if the disk has none
+    int inodesPerBlock;  // INODES_PER_BLOCK with an inode map, else 1 (an inode takes its whole block)
+    int firstFileBlock;  // blocks before it are the superblock, bitmap, checksum table, journal and inode map
+    Directory *directory; // name -> inode number
+    FileTable fileTable; // open descriptors
+    pthread_mutex_t dirLock;   // directory, and name lookup + create in fs_openFile
+    pthread_mutex_t inodeLock; // inode blocks, read, patched and written back one inode at a time
+    pthread_mutex_t allocLock; // freeMap and inodeMap (and directory block allocation)
+
+    // group commit: every call that changes metadata takes the next change number,
+    // a commit makes every change numbered so far durable with one flush
+    int commitMode;      // COMMIT_*, fixed at mount
+    int commitInterval;  // ms between COMMIT_INTERVAL flushes
+    unsigned long long changes;   // changes numbered so far
+    unsigned long long committed; // changes known to be on stable storage
+    int flushing;        // a commit is writing back right now
+    int stopping;        // unmount asked the flusher to exit
+    pthread_t flusher;   // COMMIT_INTERVAL background thread
+    pthread_mutex_t commitLock; // the fields above
+    pthread_cond_t commitDone;  // a commit finished
+    pthread_cond_t commitWake;  // the flusher should look at stopping
+};
+
+static TinyFS *defaultFS = NULL; // disk mounted with tfs_mount / tfs_mountMapped
+
+static int cacheBlocks = DEFAULT_CACHE_BLOCKS; // cache configuration used by the next mount
+static int cachePolicy = CACHE_POLICY_LRU;
+static int commitMode = COMMIT_ON_SYNC; // commit configuration used by the next mount
+static int commitInterval = DEFAULT_COMMIT_INTERVAL;
+static int journalBlocks = JOURNAL_AUTO; // journal size used by the next tfs_mkfs
+static int checksumMode = CHECKSUM_NONE; // block checksums kept by disks the next tfs_mkfs makes
+
+// number of overflow bitmap blocks a disk of totalBlocks blocks needs
+static int bitmapBlocksFor(int totalBlocks) {
+    if (totalBlocks <= SUPERBLOCK_BITMAP_BITS) {
+        return 0;
+    }
+    return (totalBlocks - SUPERBLOCK_BITMAP_BITS + BITMAP_BLOCK_BITS - 1) / BITMAP_BLOCK_BITS;
+}
 
-FileTableEntry fileTable[FILE_TABLE_SIZE]; // file table to track open files
-int recycle_fd[FILE_TABLE_SIZE] = {0};
-//I think the table needs to be dynamic, not a fixed size. I'm not sure how to implement this at the moment.
-int nextFileDescriptor = 0; // next available file descriptor
+// copy map into the bitmap part of the superblock (index 0) or of overflow block index
+static void fillBitmapBlock(Bitmap *map, int index, char *block) {
+    if (index == 0) {
+        bitmapStore(map, (unsigned char *)&block[_BITMAP], 0, SUPERBLOCK_BITMAP_BITS);
+        return;
+    }
+    memset(block, 0, BLOCKSIZE);
+    block[_BLOCK_TYPE] = 5; // bitmap block type
+    block[_MAGIC_NUMBER] = 0x44;
+    bitmapStore(map, (unsigned char *)&block[4], SUPERBLOCK_BITMAP_BITS + (index - 1) * BITMAP_BLOCK_BITS, BITMAP_BLOCK_BITS);
+}
 
-static int mounted = 0; // flag to indicate whether a file system is mounted
-static int mounted_disk = -1; // variable to store the disk number of the mounted file system
+// number of inode map blocks a disk of totalBlocks blocks needs
+static int inodeMapBlocksFor(int totalBlocks) {
+    return (totalBlocks * INODES_PER_BLOCK + INODE_MAP_BLOCK_BITS - 1) / INODE_MAP_BLOCK_BITS;
+}
 
-char superblock[BLOCKSIZE] = {0};
+// copy inode map block index of map into block
+static void fillInodeMapBlock(Bitmap *map, int index, char *block) {
+    memset(block, 0, BLOCKSIZE);
+    block[_BLOCK_TYPE] = 12; // inode map block type
+    block[_MAGIC_NUMBER] = 0x44;
+    bitmapStore(map, (unsigned char *)&block[_INODE_MAP_BITS], index * INODE_MAP_BLOCK_BITS, INODE_MAP_BLOCK_BITS);
+}
 
-int tfs_mkfs(char *filename, int nBytes) {
+// number of journal blocks tfs_mkfs reserves on a disk of totalBlocks blocks
+static int journalBlocksFor(int totalBlocks) {
+    if (journalBlocks != JOURNAL_AUTO) {
+        return journalBlocks;
+    }
+    int nBlocks = totalBlocks / 32 < 1024 ? totalBlocks / 32 : 1024;
+    return nBlocks >= JOURNAL_MIN_BLOCKS ? nBlocks : 0;
+}
+
+// tfs_mkfs without the counting
+static int formatDisk(char *filename, int nBytes) {
     // check if nBytes is valid
     if (nBytes < BLOCKSIZE) {
-        return -1; // failure (nBytes should be at least BLOCKSIZE) so return neg
+        return TFS_EINVAL; // failure (nBytes should be at least BLOCKSIZE) so return neg
     }
     
     // open the disk file using the disk emulator library
     int disk = openDisk(filename, nBytes);
-    if (disk == -1) {
-        return -1; // failure (unable to open disk file) so return neg
+    if (disk < 0) {
+        return disk; // failure (unable to open disk file) so return neg
     }
-    
-    // create and initialize the superblock
-    // superblock.magicNumber = 0x44; // magic # for TinyFS
-    // superblock.rootInodeBlock = 1; // root inode block starts from block 1
-    // superblock.numFreeBlocks = DEFAULT_DISK_SIZE / BLOCKSIZE - 2;
-    // int freeBlockIndex = 2;
-    // superblock.freeBlocks = (unsigned char*)malloc(sizeof(char)*superblock.numFreeBlocks); // first free block starts from block 2
-    // for (int i = 0; i < superblock.numFreeBlocks; i++) {
-    //     superblock.freeBlocks[i] = 0;
-    // }
+
+    int totalBlocks = nBytes / BLOCKSIZE;
+    int bitmapBlocks = bitmapBlocksFor(totalBlocks);
+    int nTable = checksumMode == CHECKSUM_BLOCK ? sumTableBlocks(totalBlocks) : 0;
+    int nJournal = journalBlocksFor(totalBlocks);
+    int nInodeMap = inodeMapBlocksFor(totalBlocks);
+    // superblock, bitmap overflow blocks, checksum table, journal and inode map come first, then the directory
+    int inodeMapBlock = 1 + bitmapBlocks + nTable + nJournal;
+    int dirBlock = inodeMapBlock + nInodeMap;
+    int firstFree = dirBlock + 1;
+    if (firstFree >= totalBlocks) {
+        closeDisk(disk);
+        return TFS_EINVAL; // failure (no room left for files)
+    }
+
+    Bitmap map;
+    if (bitmapInit(&map, totalBlocks) != 0) {
+        closeDisk(disk);
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    bitmapSet(&map, 0, firstFree);
+
     // empty block filled with 0s
+    char superblock[BLOCKSIZE] = {0};
     superblock[_BLOCK_TYPE] = 1;
     superblock[_MAGIC_NUMBER] = 0x44;
-    // superblock[_ROOT_INODE_BLOCK] = 1;
-    superblock[_FREE_BLOCK_INDEX] = 1; //is this 1 or 2?
-    superblock[_NUM_FREE_BLOCKS] = DEFAULT_DISK_SIZE / BLOCKSIZE - 2;
+    superblock[_FS_VERSION] = TFS_VERSION;
+    superblock[_BLOCK_SHIFT] = BLOCK_SHIFT;
+    setField(superblock, _ROOT_INODE_BLOCK, dirBlock);
+    setField(superblock, _FREE_BLOCK_INDEX, firstFree);
+    setField(superblock, _NUM_FREE_BLOCKS, map.nFree);
+    setField(superblock, _TOTAL_BLOCKS, totalBlocks);
+    setField(superblock, _BITMAP_BLOCKS, bitmapBlocks);
+    fillBitmapBlock(&map, 0, superblock);
     
     // write the superblock to the disk
-    if (writeBlock(disk, 0, &superblock) != 0) {     // TODO &superblock
+    if (writeBlock(disk, 0, superblock) != 0) {
+        bitmapDestroy(&map);
         closeDisk(disk);
-        return -1; // failure (unable to write superblock) so return neg
+        return TFS_EIO; // failure (unable to write superblock) so return neg
     }
 
-    printf("superblock info: %d %d %d %d %d\n", superblock[_BLOCK_TYPE], superblock[_MAGIC_NUMBER], superblock[_ROOT_INODE_BLOCK], superblock[_FREE_BLOCK_INDEX], superblock[_NUM_FREE_BLOCKS]);
-    
-    // initialize and write root inode (assume it's a single block?)
-    // char rootInode[BLOCKSIZE] = {0}; // empty block filled with 0s
-    // rootInode[_BLOCK_TYPE] = 2; // inode block type
-    // rootInode[_MAGIC_NUMBER] = 0x44; // magic number for inode block
-    // strcpy(&rootInode[_NAME], "root"); // Copy the string "root" into the inode block
-
-    // // printing to verify the contents of the inode block
-    // printf("rootInode[_BLOCK_TYPE]: %d\n", rootInode[_BLOCK_TYPE]);
-    // printf("rootInode[_MAGIC_NUMBER]: %x\n", rootInode[_MAGIC_NUMBER]);
-    // printf("rootInode[_NAME]: %s\n", &rootInode[_NAME]);
-
-    //we do not need to make an inode called "root" at the start of block... we can just start adding inodes
-    // strcpy(&rootInode[_NAME], "root"); 
-    // rootInode[_SIZE] = 0; // root directory size (empty for now)
-    // rootInode[_DATA_BLOCK] = -1; // no data blocks allocated for root directory yet
-    
-    // write the root inode to the disk
-    // if (writeBlock(disk, 1, &rootInode) != 0) {
-    //     closeDisk(disk);
-    //     return -1; // failure (unable to write root inode) so return neg
-    // }
-    
-    // initialize and write free blocks (remaining blocks after superblock and root inode)
-    char emptyBlock[BLOCKSIZE] = {0}; // empty block filled with 0s
-    
-    emptyBlock[0] = 4; // Signify free block
-    emptyBlock[1] = 0x44; // Signify magic number
-    
-    //printf("mkfs empty block for loop spans range [2, %d]\n", nBytes / BLOCKSIZE);
-    for (int i = 1; i < nBytes / BLOCKSIZE; i++) {
-        //printf("mkfs about to write empty block for disk %d\n", disk);
-        if (writeBlock(disk, i, emptyBlock) != 0) {
+    char bitmapBlock[BLOCKSIZE];
+    for (int i = 1; i <= bitmapBlocks; i++) {
+        fillBitmapBlock(&map, i, bitmapBlock);
+        if (writeBlock(disk, i, bitmapBlock) != 0) {
+            bitmapDestroy(&map);
+            closeDisk(disk);
+            return TFS_EIO; // failure (unable to write bitmap block)
+        }
+    }
+    bitmapDestroy(&map);
+
+    if (nTable > 0 && sumTableFormat(disk, 1 + bitmapBlocks, totalBlocks) != 0) {
+        closeDisk(disk);
+        return TFS_EIO; // failure (unable to write checksum table)
+    }
+
+    if (nJournal > 0 && journalFormat(disk, 1 + bitmapBlocks + nTable, nJournal) != 0) {
+        closeDisk(disk);
+        return TFS_EIO; // failure (unable to write journal)
+    }
+
+    // no inode block yet, so no free inode either: every bit is set
+    char inodeMapData[BLOCKSIZE] = {0};
+    inodeMapData[_BLOCK_TYPE] = 12; // inode map block type
+    inodeMapData[_MAGIC_NUMBER] = 0x44;
+    memset(&inodeMapData[_INODE_MAP_BITS], 0xff, BLOCKSIZE - _INODE_MAP_BITS);
+    for (int i = 0; i < nInodeMap; i++) {
+        if (writeBlock(disk, inodeMapBlock + i, inodeMapData) != 0) {
             closeDisk(disk);
-            return -1; // failure (unable to write free block) so return neg
+            return TFS_EIO; // failure (unable to write inode map block)
         }
-        //printf("mkfs wrote empytblock\n");
     }
+
+    // empty root directory, a single block with every entry free
+    char dirBlockData[BLOCKSIZE] = {0};
+    dirBlockData[_BLOCK_TYPE] = 7; // directory block type
+    dirBlockData[_MAGIC_NUMBER] = 0x44;
+    if (writeBlock(disk, dirBlock, dirBlockData) != 0) {
+        closeDisk(disk);
+        return TFS_EIO; // failure (unable to write directory block)
+    }
+
+    logDebug("superblock info: %d %d %d %d %d %d\n", superblock[_BLOCK_TYPE], superblock[_MAGIC_NUMBER], getField(superblock, _ROOT_INODE_BLOCK),
+           getField(superblock, _FREE_BLOCK_INDEX), getField(superblock, _NUM_FREE_BLOCKS), getField(superblock, _TOTAL_BLOCKS));
+    
+    // free blocks are not written: the bitmap alone says which blocks are free, so the
+    // rest of the image stays as the (sparse) space ftruncate left in openDisk and
+    // formatting costs the same for any disk size
     
-    // close disk file (should this be here?)
     closeDisk(disk);
     
     return 0; // success
 }
 
-int tfs_mount(char *diskname) {
-    if (mounted) {
-        printf("A file system is already mounted.\n");
-        return -1; // failure (file system already mounted) so return neg
+int tfs_mkfs(char *filename, int nBytes) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = formatDisk(filename, nBytes);
+    statsEnd(&span, STAT_MKFS, -1, result, 0, 0);
+    return result;
+}
+
+// read the free-block bitmap of disk (behind blockCache) into freeMap
+static int loadFreeMap(TinyFS *fs) {
+    char block[BLOCKSIZE];
+    if (cacheReadBlock(fs->cache, 0, block) != 0) {
+        return TFS_EIO; // failure (unable to read superblock)
+    }
+
+    int fileBlocks = diskBlocks(fs->disk);
+    int totalBlocks = getField(block, _TOTAL_BLOCKS);
+    if (totalBlocks <= 0) {
+        // image from before the bitmap: the disk is as big as its file and blocks are
+        // packed in front of the single byte _FREE_BLOCK_INDEX
+        if (fileBlocks <= 0) {
+            return TFS_EFORMAT; // failure (empty image)
+        }
+        if (bitmapInit(&fs->freeMap, fileBlocks) != 0) {
+            return TFS_ENOMEM;
+        }
+        int used = (unsigned char)block[_FREE_BLOCK_INDEX];
+        bitmapSet(&fs->freeMap, 0, used < fileBlocks ? used : fileBlocks);
+        fs->freeMap.dirty = 1; // convert the image on the next sync
+        fs->freeMap.dirtyLow = 0;
+        fs->freeMap.dirtyHigh = fileBlocks - 1;
+        return 0;
+    }
+    if (totalBlocks > fileBlocks) {
+        logError("Superblock claims %d blocks but the disk holds %d.\n", totalBlocks, fileBlocks);
+        return TFS_EFORMAT; // failure (truncated image)
+    }
+
+    if (bitmapInit(&fs->freeMap, totalBlocks) != 0) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    bitmapLoad(&fs->freeMap, (unsigned char *)&block[_BITMAP], 0, SUPERBLOCK_BITMAP_BITS);
+    int bitmapBlocks = getField(block, _BITMAP_BLOCKS);
+    for (int i = 1; i <= bitmapBlocks; i++) {
+        if (cacheReadBlock(fs->cache, i, block) != 0) {
+            bitmapDestroy(&fs->freeMap);
+            return TFS_EIO; // failure (unable to read bitmap block)
+        }
+        bitmapLoad(&fs->freeMap, (unsigned char *)&block[4], SUPERBLOCK_BITMAP_BITS + (i - 1) * BITMAP_BLOCK_BITS, BITMAP_BLOCK_BITS);
+    }
+    bitmapClean(&fs->freeMap);
+    return 0;
+}
+
+// write freeMap back into the superblock and overflow blocks
+static int writeFreeMap(TinyFS *fs) {
+    char block[BLOCKSIZE];
+    if (cacheReadBlock(fs->cache, 0, block) != 0) {
+        return TFS_EIO; // failure (unable to read superblock)
+    }
+    int bitmapBlocks = bitmapBlocksFor(fs->freeMap.nBits);
+    int firstFree = bitmapFindRun(&fs->freeMap, 1, 0);
+    setField(block, _FREE_BLOCK_INDEX, firstFree); // lowest free block, kept for older readers
+    setField(block, _NUM_FREE_BLOCKS, fs->freeMap.nFree + fs->freeMap.nHeld); // held blocks are stored as free
+    block[_FS_VERSION] = TFS_VERSION; // inodes written from now on use the current format
+    block[_BLOCK_SHIFT] = BLOCK_SHIFT;
+    setField(block, _ROOT_INODE_BLOCK, fs->directory != NULL ? dirFirstBlock(fs->directory) : 0);
+    setField(block, _TOTAL_BLOCKS, fs->freeMap.nBits);
+    setField(block, _BITMAP_BLOCKS, bitmapBlocks);
+    fillBitmapBlock(&fs->freeMap, 0, block);
+    if (cacheWriteBlock(fs->cache, 0, block) != 0) {
+        return TFS_EIO; // failure (unable to write superblock)
+    }
+    // only the overflow blocks holding changed bits, so a commit logs few of them
+    for (int i = 1; i <= bitmapBlocks; i++) {
+        int firstBit = SUPERBLOCK_BITMAP_BITS + (i - 1) * BITMAP_BLOCK_BITS;
+        if (firstBit > fs->freeMap.dirtyHigh || firstBit + BITMAP_BLOCK_BITS <= fs->freeMap.dirtyLow) {
+            continue;
+        }
+        fillBitmapBlock(&fs->freeMap, i, block);
+        if (cacheWriteBlock(fs->cache, i, block) != 0) {
+            return TFS_EIO; // failure (unable to write bitmap block)
+        }
+    }
+    bitmapClean(&fs->freeMap);
+    return 0;
+}
+
+// writeFreeMap if the bitmap changed since it was last written
+static int storeFreeMapLocked(TinyFS *fs) {
+    if (!fs->freeMap.dirty) {
+        return 0;
+    }
+    StatsSpan span;
+    statsBegin(&span);
+    int result = writeFreeMap(fs);
+    statsEnd(&span, STAT_FREEMAP_STORE, -1, result, 0, 0);
+    return result;
+}
+
+// read the inode map starting at block first into inodeMap. a disk without one there gives
+// every inode a whole block
+static int loadInodeMap(TinyFS *fs, int first) {
+    char block[BLOCKSIZE];
+    if (first >= fs->freeMap.nBits) {
+        return 0; // no room for one
+    }
+    if (cacheReadBlock(fs->cache, first, block) != 0) {
+        return TFS_EIO; // failure (unable to read inode map block)
+    }
+    if (block[_BLOCK_TYPE] != 12 || block[_MAGIC_NUMBER] != 0x44) {
+        return 0; // disk made before the inode map
+    }
+
+    if (bitmapInit(&fs->inodeMap, fs->freeMap.nBits * INODES_PER_BLOCK) != 0) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    int nBlocks = inodeMapBlocksFor(fs->freeMap.nBits);
+    for (int i = 0; i < nBlocks; i++) {
+        if (i > 0 && cacheReadBlock(fs->cache, first + i, block) != 0) {
+            bitmapDestroy(&fs->inodeMap);
+            return TFS_EIO; // failure (unable to read inode map block)
+        }
+        bitmapLoad(&fs->inodeMap, (unsigned char *)&block[_INODE_MAP_BITS], i * INODE_MAP_BLOCK_BITS, INODE_MAP_BLOCK_BITS);
+    }
+    bitmapClean(&fs->inodeMap);
+    fs->inodeMapBlock = first;
+    fs->inodesPerBlock = INODES_PER_BLOCK;
+    return 0;
+}
+
+// write the inode map blocks holding bits changed since it was last written
+static int storeInodeMapLocked(TinyFS *fs) {
+    if (fs->inodeMapBlock == 0 || !fs->inodeMap.dirty) {
+        return 0;
+    }
+    char block[BLOCKSIZE];
+    int nBlocks = inodeMapBlocksFor(fs->freeMap.nBits);
+    for (int i = 0; i < nBlocks; i++) {
+        int firstBit = i * INODE_MAP_BLOCK_BITS;
+        if (firstBit > fs->inodeMap.dirtyHigh || firstBit + INODE_MAP_BLOCK_BITS <= fs->inodeMap.dirtyLow) {
+            continue;
+        }
+        fillInodeMapBlock(&fs->inodeMap, i, block);
+        if (cacheWriteBlock(fs->cache, fs->inodeMapBlock + i, block) != 0) {
+            return TFS_EIO; // failure (unable to write inode map block)
+        }
+    }
+    bitmapClean(&fs->inodeMap);
+    return 0;
+}
+
+// the free-block bitmap and the inode map, each only if it changed
+static int storeFreeMap(TinyFS *fs) {
+    pthread_mutex_lock(&fs->dirLock); // the superblock also records where the directory starts
+    pthread_mutex_lock(&fs->allocLock);
+    int result = storeFreeMapLocked(fs);
+    if (result == 0) {
+        result = storeInodeMapLocked(fs);
+    }
+    pthread_mutex_unlock(&fs->allocLock);
+    pthread_mutex_unlock(&fs->dirLock);
+    return result;
+}
+
+// every logged transaction is in place: make that durable and start the journal over.
+// with release, the blocks freed since the last release can be handed out again, no
+// transaction that could still be replayed has an image of them any more
+static int checkpointFS(TinyFS *fs, int release) {
+    if (fs->homeStale || journalCheckpoint(fs->journal) != 0) {
+        return TFS_EIO; // failure (home locations not known to be written)
+    }
+    if (release) {
+        pthread_mutex_lock(&fs->allocLock);
+        bitmapRelease(&fs->freeMap);
+        fs->reclaim = 0;
+        pthread_mutex_unlock(&fs->allocLock);
+    }
+    return 0;
+}
+
+// flushFS on a journaled disk, with txLock held exclusively so no call is halfway through
+// a change: the dirty blocks are logged as one transaction, then written in place unsynced
+static int commitJournal(TinyFS *fs) {
+    if (storeFreeMap(fs) != 0 || (fs->sums != NULL && sumTableStore(fs->sums) != 0)) {
+        return TFS_EIO; // failure (unable to write bitmap or checksum table)
+    }
+    int *bNums;
+    char *blocks;
+    int count = cacheCollectDirty(fs->cache, &bNums, &blocks);
+    if (count < 0) {
+        return TFS_ENOMEM; // failure (no room to copy the transaction)
+    }
+    pthread_mutex_lock(&fs->allocLock);
+    int reclaim = fs->reclaim || fs->freeMap.nHeld > fs->freeMap.nFree;
+    pthread_mutex_unlock(&fs->allocLock);
+
+    int result = 0;
+    if (count == 0) {
+        result = syncDisk(fs->disk); // file data written since the last commit
+    } else if (count > journalCapacity(fs->journal)) {
+        // cannot be logged: written in place like an unjournaled disk, after a checkpoint
+        // so no older transaction is replayed over it
+        logError("Commit of %d blocks does not fit the journal, writing it in place.\n", count);
+        result = checkpointFS(fs, 0);
+        if (result == 0 && (cacheSync(fs->cache) != 0 || syncDisk(fs->disk) != 0)) {
+            result = TFS_EIO; // failure (dirty blocks could not be written back)
+        }
+    } else {
+        if (!journalFits(fs->journal, count)) {
+            result = checkpointFS(fs, 0);
+        }
+        if (result == 0) {
+            result = journalCommit(fs->journal, count, bNums, blocks);
+        }
+        if (result == 0) {
+            fs->homeStale = cacheSync(fs->cache) != 0; // durable in the log, a later commit retries the rest
+        }
+    }
+    free(bNums);
+    free(blocks);
+    if (result == 0 && reclaim) {
+        result = checkpointFS(fs, 1);
+    }
+    return result;
+}
+
+// write back the bitmap and every dirty cached block, then msync / fsync so they are on stable storage
+static int flushFS(TinyFS *fs) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result;
+    if (fs->journal != NULL) {
+        pthread_rwlock_wrlock(&fs->txLock);
+        result = commitJournal(fs);
+        pthread_rwlock_unlock(&fs->txLock);
+    } else if (storeFreeMap(fs) != 0 || (fs->sums != NULL && sumTableStore(fs->sums) != 0) ||
+               cacheSync(fs->cache) != 0) {
+        result = TFS_EIO; // failure (dirty blocks could not be written back)
+    } else {
+        result = syncDisk(fs->disk);
+    }
+    statsEnd(&span, STAT_COMMIT, fs->disk, result, 0, 0);
+    return result;
+}
+
+// number the metadata change a call just made, call it once the change is in memory
+static unsigned long long noteChange(TinyFS *fs) {
+    pthread_mutex_lock(&fs->commitLock);
+    unsigned long long ticket = ++fs->changes;
+    pthread_mutex_unlock(&fs->commitLock);
+    return ticket;
+}
+
+// make every change up to ticket durable. callers arriving while a flush runs wait for
+// it and then share the next one, so a burst of calls costs a few flushes, not one each
+static int commitUpTo(TinyFS *fs, unsigned long long ticket) {
+    int result = 0;
+    pthread_mutex_lock(&fs->commitLock);
+    while (result == 0 && fs->committed < ticket) {
+        if (fs->flushing) {
+            pthread_cond_wait(&fs->commitDone, &fs->commitLock);
+            continue;
+        }
+        fs->flushing = 1;
+        unsigned long long upTo = fs->changes; // every change numbered so far is in memory, this flush covers it
+        pthread_mutex_unlock(&fs->commitLock);
+        result = flushFS(fs);
+        pthread_mutex_lock(&fs->commitLock);
+        fs->flushing = 0;
+        if (result == 0 && upTo > fs->committed) {
+            fs->committed = upTo;
+        }
+        pthread_cond_broadcast(&fs->commitDone);
+    }
+    pthread_mutex_unlock(&fs->commitLock);
+    return result;
+}
+
+// a call made change ticket (0 = no change): in COMMIT_EACH_CALL mode it returns only once that is durable
+static int commitChange(TinyFS *fs, unsigned long long ticket) {
+    if (ticket == 0 || fs->commitMode != COMMIT_EACH_CALL) {
+        return 0; // the flusher, fs_sync or unmount writes it back
+    }
+    return commitUpTo(fs, ticket);
+}
+
+// start a call that changes metadata. on a journaled disk no commit runs until txEnd, so a
+// transaction never holds half of a call. a commit runs first if the changes waiting
+// already take half the journal, or freed blocks held for it are needed again
+static void txBegin(TinyFS *fs) {
+    if (fs->journal == NULL) {
+        return;
     }
+    pthread_mutex_lock(&fs->allocLock);
+    int reclaim = fs->freeMap.nHeld > fs->freeMap.nFree;
+    pthread_mutex_unlock(&fs->allocLock);
+    if ((reclaim || cacheDirtyCount(fs->cache) > journalCapacity(fs->journal) / 2) &&
+        commitUpTo(fs, noteChange(fs)) != 0) {
+        logError("Commit before a change failed.\n");
+    }
+    pthread_rwlock_rdlock(&fs->txLock);
+}
+
+static void txEnd(TinyFS *fs) {
+    if (fs->journal != NULL) {
+        pthread_rwlock_unlock(&fs->txLock);
+    }
+}
+
+// a call ran out of space: if freed blocks are held for the journal, commit and release
+// them. returns 1 when the call is worth retrying
+static int reclaimHeld(TinyFS *fs) {
+    if (fs->journal == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&fs->allocLock);
+    int held = fs->freeMap.nHeld;
+    fs->reclaim = held > 0;
+    pthread_mutex_unlock(&fs->allocLock);
+    return held > 0 && commitUpTo(fs, noteChange(fs)) == 0;
+}
+
+// COMMIT_INTERVAL: commit whatever changed every commitInterval ms until unmount
+static void *flusherMain(void *arg) {
+    TinyFS *fs = arg;
+    pthread_mutex_lock(&fs->commitLock);
+    while (!fs->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long long nanos = deadline.tv_nsec + (long long)fs->commitInterval * 1000000;
+        deadline.tv_sec += nanos / 1000000000;
+        deadline.tv_nsec = nanos % 1000000000;
+        pthread_cond_timedwait(&fs->commitWake, &fs->commitLock, &deadline);
+        unsigned long long ticket = fs->changes;
+        if (fs->stopping || ticket <= fs->committed) {
+            continue;
+        }
+        pthread_mutex_unlock(&fs->commitLock);
+        if (commitUpTo(fs, ticket) != 0) {
+            logError("Background commit failed, retrying in %d ms.\n", fs->commitInterval);
+        }
+        pthread_mutex_lock(&fs->commitLock);
+    }
+    pthread_mutex_unlock(&fs->commitLock);
+    return NULL;
+}
+
+// add every inode in an inode block (every used block of type 2) to the directory. the inode
+// map is redone along the way: the free slots of those blocks are the only clear bits
+static int scanInodes(TinyFS *fs) {
+    char block[BLOCKSIZE];
+    int perBlock = fs->inodesPerBlock;
+    if (perBlock > 1) {
+        bitmapSet(&fs->inodeMap, 0, fs->inodeMap.nBits);
+    }
+    // the journal holds copies of inode blocks, so the scan starts after it
+    for (int i = fs->firstFileBlock; i < fs->freeMap.nBits; i++) {
+        if (!bitmapTest(&fs->freeMap, i)) {
+            continue; // free blocks cannot hold an inode
+        }
+        if (cacheReadBlock(fs->cache, i, block) != 0) {
+            return TFS_EIO; // failure (unable to read block)
+        }
+        if (block[_BLOCK_TYPE] != 2 || block[_MAGIC_NUMBER] != 0x44) {
+            continue;
+        }
+        for (int slot = 0; slot < perBlock; slot++) {
+            char *inode = &block[slot * (BLOCKSIZE / perBlock)];
+            char name[MAX_NAME_LENGTH + 1] = {0};
+            memcpy(name, &inode[_NAME], MAX_NAME_LENGTH);
+            int ino = i * perBlock + slot;
+            if (perBlock > 1 && name[0] == '\0') {
+                bitmapClear(&fs->inodeMap, ino, 1);
+            }
+            if (name[0] != '\0' && dirLookup(fs->directory, name) == -1 && dirInsert(fs->directory, name, ino) != 0) {
+                return TFS_ENOSPC; // failure (unable to add directory entry)
+            }
+        }
+    }
+    return 0;
+}
+
+// fill directory from the inode blocks themselves, the one full disk scan TinyFS does
+static int rebuildDirectory(TinyFS *fs) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = scanInodes(fs);
+    statsEnd(&span, STAT_DIR_REBUILD, -1, result, 0, 0);
+    return result;
+}
+
+// load the directory named by the superblock, or build one from the inodes if there is none
+static int loadDirectory(TinyFS *fs) {
+    char block[BLOCKSIZE];
+    if (cacheReadBlock(fs->cache, 0, block) != 0) {
+        return TFS_EIO; // failure (unable to read superblock)
+    }
+    fs->directory = dirLoad(fs->cache, &fs->freeMap, getField(block, _ROOT_INODE_BLOCK));
+    if (fs->directory != NULL) {
+        return 0;
+    }
+    logInfo("Directory missing, rebuilding it from the inode blocks.\n");
+    fs->directory = dirCreate(fs->cache, &fs->freeMap);
+    if (fs->directory == NULL || rebuildDirectory(fs) != 0) {
+        dirDestroy(fs->directory);
+        fs->directory = NULL;
+        return TFS_ECORRUPT; // failure (unable to build directory)
+    }
+    return 0;
+}
 
+// undo a partly finished mount, everything that is set up is released
+static void releaseFS(TinyFS *fs) {
+    dirDestroy(fs->directory);
+    bitmapDestroy(&fs->freeMap);
+    bitmapDestroy(&fs->inodeMap);
+    asyncClose(fs->async);
+    cacheDestroy(fs->cache);
+    journalClose(fs->journal);
+    sumTableClose(fs->sums);
+    closeDisk(fs->disk);
+    pthread_rwlock_destroy(&fs->txLock);
+    pthread_mutex_destroy(&fs->dirLock);
+    pthread_mutex_destroy(&fs->inodeLock);
+    pthread_mutex_destroy(&fs->allocLock);
+    pthread_mutex_destroy(&fs->commitLock);
+    pthread_cond_destroy(&fs->commitDone);
+    pthread_cond_destroy(&fs->commitWake);
+    free(fs);
+}
+
+// the work behind mountDisk, on failure *error says why
+static TinyFS *openFS(char *diskname, int mapped, int *error) {
     // open the disk file using libDisk
-    int disk = openDisk(diskname, 0);
-    if (disk == -1) {
-        printf("Failed to open disk.\n");
-        return -1; // failure (unable to open disk file) so return neg
+    int disk = mapped ? openDiskMapped(diskname, 0) : openDisk(diskname, 0);
+    if (disk < 0) {
+        logError("Failed to open disk %s.\n", diskname);
+        *error = disk;
+        return NULL; // failure (unable to open disk file)
     }
-    printf("in mount, opened disk %d\n", disk);
+    logDebug("in mount, opened disk %d\n", disk);
 
     // read superblock from disk via libDisk
-    Superblock superblock;  // 13 bytes made
-    if (readBlock(disk, SUPERBLOCK_BLOCK_NUM, &superblock) != 0) {
+    char superblock[BLOCKSIZE];
+    if (readBlock(disk, SUPERBLOCK_BLOCK_NUM, superblock) != 0) {
         closeDisk(disk);
-        printf("Failed to read superblock.\n");
-        return -1; // failure (unable to read superblock)
+        logError("Failed to read superblock.\n");
+        *error = TFS_EIO;
+        return NULL; // failure (unable to read superblock)
     }
 
-    //printf("superblock info: %d %d %d %d %d %s\n", superblock.blockType, superblock.magicNumber, superblock.rootInodeBlock, superblock.freeBlockIndex, superblock.numFreeBlocks, superblock.freeSpace);
-
     // check if magic number is correct
-    if (superblock.magicNumber != 0x44) {
+    if (superblock[_MAGIC_NUMBER] != 0x44) {
         closeDisk(disk);
-        printf("Incorrect magic number. Not a TinyFS filesystem.\n");
-        return -1; // failure (not a TinyFS filesystem) so return neg
+        logError("Incorrect magic number. Not a TinyFS filesystem.\n");
+        *error = TFS_EFORMAT;
+        return NULL; // failure (not a TinyFS filesystem)
     }
 
-    // update mounted flag and disk number
-    mounted = 1;
-    mounted_disk = disk;
-    printf("tfs_mount: mounted_disk = %d\n", mounted_disk);
+    // older formats are read (and upgraded on write), newer ones are refused
+    if (((unsigned char *)superblock)[_FS_VERSION] > TFS_VERSION) {
+        closeDisk(disk);
+        logError("Disk uses a newer TinyFS format.\n");
+        *error = TFS_EVERSION;
+        return NULL; // failure (unknown on-disk format)
+    }
 
-    printf("File system mounted successfully.\n");
+    // the block size is fixed per build, a disk made with another one cannot be parsed
+    int blockShift = ((unsigned char *)superblock)[_BLOCK_SHIFT];
+    if ((blockShift == 0 ? 8 : blockShift) != BLOCK_SHIFT) {
+        closeDisk(disk);
+        logError("Disk uses %d byte blocks, this build uses %d.\n", 1 << (blockShift == 0 ? 8 : blockShift), BLOCKSIZE);
+        *error = TFS_EVERSION;
+        return NULL; // failure (block size mismatch)
+    }
 
-    return 0; // success
+    TinyFS *fs = calloc(1, sizeof(TinyFS));
+    if (fs == NULL) {
+        closeDisk(disk);
+        *error = TFS_ENOMEM;
+        return NULL; // failure (out of memory)
+    }
+    fs->disk = disk;
+    pthread_rwlock_init(&fs->txLock, NULL);
+    pthread_mutex_init(&fs->dirLock, NULL);
+    pthread_mutex_init(&fs->inodeLock, NULL);
+    pthread_mutex_init(&fs->allocLock, NULL);
+    pthread_mutex_init(&fs->commitLock, NULL);
+    pthread_cond_init(&fs->commitDone, NULL);
+    pthread_cond_init(&fs->commitWake, NULL);
+    fs->commitMode = commitMode;
+    fs->commitInterval = commitInterval;
+
+    // a mapped image already lives in memory, so the cache only passes calls through
+    fs->cache = cacheCreate(disk, mapped ? 0 : cacheBlocks, cachePolicy);
+    if (fs->cache == NULL) {
+        releaseFS(fs);
+        *error = TFS_ENOMEM;
+        return NULL; // failure (unable to set up the cache)
+    }
+    fs->async = mapped ? NULL : asyncOpen(disk, ASYNC_DEPTH, ASYNC_ENGINE_AUTO);
+    if (fs->async == NULL && !mapped) {
+        logInfo("No async I/O engine, large reads and writes go one chunk at a time.\n");
+    }
+
+    // a checksum table, if the disk has one, sits right after the bitmap blocks
+    int version = ((unsigned char *)superblock)[_FS_VERSION];
+    int totalBlocks = getField(superblock, _TOTAL_BLOCKS);
+    int tableBlock = 1 + getField(superblock, _BITMAP_BLOCKS);
+    int nTable = 0;
+    char probe[BLOCKSIZE];
+    if (version >= 6 && readBlock(disk, tableBlock, probe) == 0 && probe[_BLOCK_TYPE] == 11 && probe[_MAGIC_NUMBER] == 0x44) {
+        nTable = sumTableBlocks(totalBlocks);
+    }
+
+    // a crash leaves committed transactions to replay before any metadata is read.
+    // only disks written by this version can have a journal after the bitmap blocks
+    int loaded = 0;
+    if (version >= 5) {
+        loaded = journalOpen(disk, tableBlock + nTable, &fs->journal);
+    }
+    if (loaded != 0) {
+        releaseFS(fs);
+        logError("Failed to replay the journal.\n");
+        *error = loaded;
+        return NULL; // failure (unable to replay journal)
+    }
+    // the inode map comes right after the journal, or after the checksum table without one
+    int inodeMapBlock = tableBlock + nTable;
+    if (version >= 5 && readBlock(disk, inodeMapBlock, probe) == 0 && probe[_BLOCK_TYPE] == 8 && probe[_MAGIC_NUMBER] == 0x44) {
+        inodeMapBlock += getField(probe, _JOURNAL_BLOCKS);
+    }
+    if (fs->journal != NULL && cacheBlocks > 0 && !mapped) {
+        cacheHoldDirty(fs->cache); // metadata reaches its home location only after it is logged
+    } else {
+        journalClose(fs->journal); // a mapped or uncached mount writes in place, replaying was all it needed
+        fs->journal = NULL;
+    }
+
+    loaded = loadFreeMap(fs);
+    if (loaded != 0) {
+        releaseFS(fs);
+        logError("Failed to load free-block bitmap.\n");
+        *error = loaded;
+        return NULL; // failure (unable to read bitmap)
+    }
+    if (fs->journal != NULL && bitmapHold(&fs->freeMap) != 0) {
+        releaseFS(fs);
+        *error = TFS_ENOMEM;
+        return NULL; // failure (out of memory)
+    }
+
+    if (nTable > 0) {
+        loaded = sumTableOpen(fs->cache, tableBlock, fs->freeMap.nBits, &fs->sums);
+        if (loaded != 0) {
+            releaseFS(fs);
+            logError("Failed to load checksum table.\n");
+            *error = loaded;
+            return NULL; // failure (unable to read checksum table)
+        }
+    }
+
+    fs->inodesPerBlock = 1; // unless there is an inode map
+    loaded = version >= 9 ? loadInodeMap(fs, inodeMapBlock) : 0;
+    if (loaded != 0) {
+        releaseFS(fs);
+        logError("Failed to load inode map.\n");
+        *error = loaded;
+        return NULL; // failure (unable to read inode map)
+    }
+    fs->firstFileBlock = inodeMapBlock + (fs->inodeMapBlock != 0 ? inodeMapBlocksFor(fs->freeMap.nBits) : 0);
+
+    loaded = loadDirectory(fs);
+    if (loaded != 0) {
+        releaseFS(fs);
+        logError("Failed to load directory.\n");
+        *error = loaded;
+        return NULL; // failure (unable to read directory)
+    }
+
+    if (fileTableInit(&fs->fileTable) != 0) {
+        releaseFS(fs);
+        *error = TFS_ENOMEM;
+        return NULL; // failure (unable to set up file table)
+    }
+
+    if (fs->commitMode == COMMIT_INTERVAL && pthread_create(&fs->flusher, NULL, flusherMain, fs) != 0) {
+        fileTableDestroy(&fs->fileTable);
+        releaseFS(fs);
+        *error = TFS_ENOMEM;
+        return NULL; // failure (unable to start the flusher thread)
+    }
+
+    logInfo("File system %s mounted.\n", diskname);
+
+    return fs; // success
 }
 
-int tfs_unmount(void) {
-    if (!mounted) {
-        printf("No file system is currently mounted.\n");
-        return -1; // failure (no file system mounted) so return neg
+// shared by every mount call, on failure *error says why
+static TinyFS *mountDisk(char *diskname, int mapped, int *error) {
+    StatsSpan span;
+    statsBegin(&span);
+    TinyFS *fs = openFS(diskname, mapped, error);
+    statsEnd(&span, STAT_MOUNT, fs != NULL ? fs->disk : -1, fs != NULL ? 0 : *error, 0, 0);
+    return fs;
+}
+
+TinyFS *fs_mount(char *diskname) {
+    int error;
+    return mountDisk(diskname, 0, &error);
+}
+
+TinyFS *fs_mountMapped(char *diskname) {
+    int error;
+    return mountDisk(diskname, 1, &error);
+}
+
+// fs_unmount without the counting
+static int closeFS(TinyFS *fs) {
+    if (fs == NULL) {
+        return TFS_ENOTMOUNTED; // failure (no file system mounted) so return neg
+    }
+
+    if (fs->commitMode == COMMIT_INTERVAL) {
+        pthread_mutex_lock(&fs->commitLock);
+        fs->stopping = 1;
+        pthread_cond_signal(&fs->commitWake);
+        pthread_mutex_unlock(&fs->commitLock);
+        pthread_join(fs->flusher, NULL);
+    }
+
+    // write back the bitmap and everything still dirty in the cache before the disk goes away.
+    // a journal is left empty, so the next mount has nothing to replay
+    int result;
+    if (fs->journal != NULL) {
+        result = flushFS(fs);
+        if (result == 0) {
+            result = checkpointFS(fs, 1);
+        }
+        if (result != 0) {
+            logError("Failed to commit metadata.\n");
+        }
+    } else if ((result = storeFreeMap(fs)) != 0) {
+        logError("Failed to write free-block bitmap.\n");
+    } else if (fs->sums != NULL && (result = sumTableStore(fs->sums)) != 0) {
+        logError("Failed to write checksum table.\n");
+    }
+    fileTableDestroy(&fs->fileTable); // descriptors do not outlive the mount
+    dirDestroy(fs->directory);
+    bitmapDestroy(&fs->freeMap);
+    bitmapDestroy(&fs->inodeMap);
+    asyncClose(fs->async); // nothing is in flight once every call has returned
+    if (cacheDestroy(fs->cache) != 0) {
+        logError("Failed to flush block cache.\n");
+        result = TFS_EIO;
+    } else if (syncDisk(fs->disk) != 0) {
+        logError("Failed to sync disk.\n");
+        result = TFS_EIO; // failure (written back, but maybe not on stable storage)
     }
+    journalClose(fs->journal);
+    sumTableClose(fs->sums);
+    pthread_rwlock_destroy(&fs->txLock);
+    pthread_mutex_destroy(&fs->dirLock);
+    pthread_mutex_destroy(&fs->inodeLock);
+    pthread_mutex_destroy(&fs->allocLock);
+    pthread_mutex_destroy(&fs->commitLock);
+    pthread_cond_destroy(&fs->commitDone);
+    pthread_cond_destroy(&fs->commitWake);
 
     // Close the disk file
-    if (closeDisk(mounted_disk) != 0) {
-        printf("Failed to close disk.\n");
-        return -1; // failure (unable to close disk)
+    int closed = closeDisk(fs->disk);
+    free(fs);
+    if (closed != 0) {
+        logError("Failed to close disk.\n");
+        return closed; // failure (unable to close disk)
     }
 
-    // reset mounted flag and disk number
-    mounted = 0;
-    mounted_disk = -1;
+    logInfo("File system unmounted.\n");
 
-    printf("File system unmounted successfully.\n");
+    return result; // success unless something could not be written back
+}
+
+int fs_unmount(TinyFS *fs) {
+    StatsSpan span;
+    statsBegin(&span);
+    int disk = fs != NULL ? fs->disk : -1;
+    int result = closeFS(fs);
+    statsEnd(&span, STAT_UNMOUNT, disk, result, 0, 0);
+    return result;
+}
 
+int fs_sync(TinyFS *fs) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result;
+    if (fs == NULL) {
+        result = TFS_ENOTMOUNTED; // failure (no file system mounted)
+    } else {
+        result = commitUpTo(fs, noteChange(fs)); // a flush that starts after this call, shared with any caller waiting
+    }
+    statsEnd(&span, STAT_SYNC, -1, result, 0, 0);
+    return result;
+}
+
+// contents of block bNum for read-only parsing: a pointer straight into the
+// mapping when the disk is memory-mapped, otherwise the block is read through
+// the cache into scratch. returns NULL on failure.
+static char *peekBlock(TinyFS *fs, int bNum, char *scratch) {
+    char *mappedBlock = mapBlock(fs->disk, bNum);
+    if (mappedBlock != NULL) {
+        statsCacheAccess(1, 0, 0);
+        return mappedBlock;
+    }
+    if (cacheReadBlock(fs->cache, bNum, scratch) != 0) {
+        return NULL;
+    }
+    return scratch;
+}
+
+int tfs_configureCache(int nBlocks, int policy) {
+    if (nBlocks < 0 || (policy != CACHE_POLICY_LRU && policy != CACHE_POLICY_CLOCK)) {
+        return TFS_EINVAL; // failure (bad configuration)
+    }
+    cacheBlocks = nBlocks;
+    cachePolicy = policy;
     return 0; // success
 }
 
-fileDescriptor tfs_openFile(char *name) {
-    if (!mounted) {
-        printf("No file system is currently mounted.\n");
-        return -1; // failure (no file system mounted)
+int tfs_configureCommit(int mode, int intervalMs) {
+    if (mode != COMMIT_ON_SYNC && mode != COMMIT_INTERVAL && mode != COMMIT_EACH_CALL) {
+        return TFS_EINVAL; // failure (unknown mode)
+    }
+    if (mode == COMMIT_INTERVAL && intervalMs <= 0) {
+        return TFS_EINVAL; // failure (interval must be positive)
     }
+    commitMode = mode;
+    commitInterval = mode == COMMIT_INTERVAL ? intervalMs : DEFAULT_COMMIT_INTERVAL;
+    return 0; // success
+}
 
-    if (name == NULL) {
-        printf("Empty name.\n");
-        return -1;
+int tfs_configureChecksums(int mode) {
+    if (mode != CHECKSUM_NONE && mode != CHECKSUM_BLOCK) {
+        return TFS_EINVAL; // failure (unknown checksum mode)
     }
+    checksumMode = mode;
+    return 0; // success
+}
 
-    if (strnlen(name, 8) == 0) {
-        printf("Name too short.\n");
-        return -1;
+int tfs_configureJournal(int nBlocks) {
+    if (nBlocks != JOURNAL_AUTO && nBlocks != 0 && nBlocks < JOURNAL_MIN_BLOCKS) {
+        return TFS_EINVAL; // failure (too small to hold a transaction worth logging)
     }
+    journalBlocks = nBlocks;
+    return 0; // success
+}
 
-    // check if file already exists
-    char inode[BLOCKSIZE] = {0};
-    int inodeIndex = -1;
-    for (int i = 0; i < BLOCK_COUNT-1; i++) {    // should run through all inodes
-        // to find if file already exists, we want to run through each name and compare to our input name
-        if (readBlock(mounted_disk, 1 + i, inode) != 0) { //inode and file extent blocks start from block 1
-            printf("Failed to read root inode block.\n");
-            return -1; // failure (unable to read root inode block)
-        }
-        printf("] tfs_openFile SUPERBLOCK INODE INFO:\n");      // was originally root
-        printf("    ] rootInode[_BLOCK_TYPE]: %d\n", inode[_BLOCK_TYPE]);
-        printf("    ] rootInode[_MAGIC_NUMBER]: %x\n", inode[_MAGIC_NUMBER]);
-        printf("    ] rootInode[_NAME]: %s\n", &inode[_NAME]);
-        printf("] END ROOT INODE INFO\n");
-        //its block loaded is in fact an inode block (and not a data block)
-       
-        // look for a free inode from root inode
-        if (inode[_BLOCK_TYPE] == 2 && inode[_MAGIC_NUMBER] == 0x44){  // first root inode     
-            char temp_name[9] = {0};
-            memcpy(&temp_name, &inode[_NAME], 9);
-            if (strcmp(temp_name, name) == 0) {     // compare names to see if file alreay exists 
-                inodeIndex = i+1;
-                break;
-            }
-            if (inodeIndex != -1) {
-                break;
+// allocate a contiguous run of count blocks, returns the first one
+static int allocateBlocks(TinyFS *fs, int count) {
+    pthread_mutex_lock(&fs->allocLock);
+    int first = bitmapFindRun(&fs->freeMap, count, 1);
+    if (first != -1) {
+        bitmapSet(&fs->freeMap, first, count);
+    }
+    pthread_mutex_unlock(&fs->allocLock);
+    return first; // -1 on failure (no free run that long)
+}
+
+// give blocks [start, start + count) back to the free-block bitmap
+static void releaseBlocks(TinyFS *fs, int start, int count) {
+    if (count <= 0) {
+        return; // nothing to do
+    }
+    pthread_mutex_lock(&fs->allocLock);
+    bitmapClear(&fs->freeMap, start, count);
+    pthread_mutex_unlock(&fs->allocLock);
+}
+
+// give inode numbers [start, start + count) back to the inode map
+static void releaseInodes(TinyFS *fs, int start, int count) {
+    pthread_mutex_lock(&fs->allocLock);
+    bitmapClear(&fs->inodeMap, start, count);
+    pthread_mutex_unlock(&fs->allocLock);
+}
+
+// record the checksums of count data or inode blocks about to be written at bNum
+static void noteWritten(TinyFS *fs, int bNum, int count, const char *blocks) {
+    if (fs->sums != NULL) {
+        sumTableUpdate(fs->sums, bNum, count, blocks);
+    }
+}
+
+// TFS_ECHECKSUM if count data or inode blocks just read from bNum were damaged on disk
+static int checkRead(TinyFS *fs, int bNum, int count, const char *blocks) {
+    return fs->sums != NULL ? sumTableVerify(fs->sums, bNum, count, blocks) : 0;
+}
+
+// bytes an inode takes on this disk: INODE_SIZE, or the whole block without an inode map
+static int inodeBytes(TinyFS *fs) {
+    return BLOCKSIZE / fs->inodesPerBlock;
+}
+
+// where inode ino starts in its block
+static int inodeOffset(TinyFS *fs, int ino) {
+    return ino % fs->inodesPerBlock * inodeBytes(fs);
+}
+
+// inode ino for read-only parsing, see peekBlock
+static char *peekInode(TinyFS *fs, int ino, char *scratch) {
+    char *block = peekBlock(fs, ino / fs->inodesPerBlock, scratch);
+    return block != NULL ? block + inodeOffset(fs, ino) : NULL;
+}
+
+// write inode ino back through the cache, with inodeLock held. an inode sharing its
+// block with others is patched into the cached block
+static int storeInodeLocked(TinyFS *fs, int ino, char *inode) {
+    int bNum = ino / fs->inodesPerBlock;
+    char block[BLOCKSIZE];
+    if (fs->inodesPerBlock > 1) {
+        if (cacheReadBlock(fs->cache, bNum, block) != 0) {
+            logError("Failed to read inode block %d.\n", bNum);
+            return TFS_EIO; // failure (unable to read the other inodes)
+        }
+        memcpy(&block[inodeOffset(fs, ino)], inode, INODE_SIZE);
+        inode = block;
+    }
+    noteWritten(fs, bNum, 1, inode);
+    if (cacheWriteBlock(fs->cache, bNum, inode) != 0) {
+        logError("Failed to write inode block %d.\n", bNum);
+        return TFS_EIO; // failure (unable to write inode block)
+    }
+    return 0;
+}
+
+static int storeInode(TinyFS *fs, int ino, char *inode) {
+    pthread_mutex_lock(&fs->inodeLock);
+    int result = storeInodeLocked(fs, ino, inode);
+    pthread_mutex_unlock(&fs->inodeLock);
+    return result;
+}
+
+// write the new inode to a free inode number, returned. the lowest free slot in an inode
+// block is taken, a new inode block is started only when there is none
+static int allocateInode(TinyFS *fs, char *inode) {
+    int perBlock = fs->inodesPerBlock;
+    if (perBlock == 1) {
+        int bNum = allocateBlocks(fs, 1);
+        if (bNum == -1) {
+            return TFS_ENOSPC; // failure (no block left for the inode)
+        }
+        if (storeInode(fs, bNum, inode) != 0) {
+            releaseBlocks(fs, bNum, 1);
+            return TFS_EIO; // failure (unable to write inode block)
+        }
+        return bNum;
+    }
+
+    char block[BLOCKSIZE];
+    int ino;
+    int fresh;
+    pthread_mutex_lock(&fs->inodeLock);
+    for (;;) {
+        int count;
+        pthread_mutex_lock(&fs->allocLock);
+        ino = bitmapFindFree(&fs->inodeMap, 0, 1, &count);
+        fresh = ino == -1;
+        if (!fresh) {
+            bitmapSet(&fs->inodeMap, ino, 1);
+        } else if ((ino = bitmapFindRun(&fs->freeMap, 1, 1)) != -1) {
+            bitmapSet(&fs->freeMap, ino, 1);
+            ino *= perBlock;
+        }
+        pthread_mutex_unlock(&fs->allocLock);
+        if (ino == -1) {
+            pthread_mutex_unlock(&fs->inodeLock);
+            return TFS_ENOSPC; // failure (no free slot and no block for another inode block)
+        }
+        int bNum = ino / perBlock;
+        if (fresh) {
+            // every slot of a new inode block starts out free
+            memset(block, 0, BLOCKSIZE);
+            for (int slot = 0; slot < perBlock; slot++) {
+                block[slot * INODE_SIZE + _BLOCK_TYPE] = 2; // inode block type
+                block[slot * INODE_SIZE + _MAGIC_NUMBER] = 0x44;
             }
+            break;
+        }
+        if (cacheReadBlock(fs->cache, bNum, block) != 0) {
+            releaseInodes(fs, ino, 1);
+            pthread_mutex_unlock(&fs->inodeLock);
+            return TFS_EIO; // failure (unable to read inode block)
+        }
+        // a map older than the inode blocks (written before a crash) may call a slot in use free,
+        // or a block no longer holding inodes: those bits stay set, the search goes on
+        if (bitmapTest(&fs->freeMap, bNum) && block[_BLOCK_TYPE] == 2 && block[_MAGIC_NUMBER] == 0x44 &&
+            block[inodeOffset(fs, ino) + _NAME] == '\0') {
+            break;
         }
     }
-    // create a new inode for file since it doesn't exist, put at freeblock
-    if (inodeIndex == -1) {
-        // find free inode block, then free inode within that block
-        char superblock[BLOCKSIZE];
-        int rb = readBlock(mounted_disk, 0, superblock);
-        if (rb == -1) {
-            printf("Failed to read superblock.\n");
-            return -1; // failure (unable to read superblock)
+
+    int bNum = ino / perBlock;
+    memcpy(&block[inodeOffset(fs, ino)], inode, INODE_SIZE);
+    noteWritten(fs, bNum, 1, block);
+    if (cacheWriteBlock(fs->cache, bNum, block) != 0) {
+        if (fresh) {
+            releaseBlocks(fs, bNum, 1);
+        } else {
+            releaseInodes(fs, ino, 1);
+        }
+        pthread_mutex_unlock(&fs->inodeLock);
+        logError("Failed to write inode block %d.\n", bNum);
+        return TFS_EIO; // failure (unable to write inode block)
+    }
+    if (fresh) {
+        releaseInodes(fs, ino + 1, perBlock - 1); // the other slots of the new block
+    }
+    pthread_mutex_unlock(&fs->inodeLock);
+    return ino;
+}
+
+// clear inode ino, freeing its block once no inode is left in it
+static int freeInode(TinyFS *fs, int ino) {
+    int perBlock = fs->inodesPerBlock;
+    int bNum = ino / perBlock;
+    int first = bNum * perBlock;
+    char block[BLOCKSIZE] = {0};
+    pthread_mutex_lock(&fs->inodeLock);
+    int empty = 1;
+    if (perBlock > 1) {
+        pthread_mutex_lock(&fs->allocLock);
+        bitmapClear(&fs->inodeMap, ino, 1);
+        empty = bitmapRangeFree(&fs->inodeMap, first, perBlock);
+        if (empty) {
+            bitmapSet(&fs->inodeMap, first, perBlock); // no slots here any more, the block is freed below
+        }
+        pthread_mutex_unlock(&fs->allocLock);
+    }
+    int result = 0;
+    if (empty) {
+        // rewritten as a free block so a rebuild no longer finds it
+        block[_BLOCK_TYPE] = 4; // Signify free block
+        block[_MAGIC_NUMBER] = 0x44; // Signify magic number
+    } else if (cacheReadBlock(fs->cache, bNum, block) == 0) {
+        char *inode = &block[inodeOffset(fs, ino)];
+        memset(inode, 0, INODE_SIZE);
+        inode[_BLOCK_TYPE] = 2; // free slot
+        inode[_MAGIC_NUMBER] = 0x44;
+    } else {
+        result = TFS_EIO; // failure (unable to read the other inodes)
+    }
+    if (result == 0) {
+        noteWritten(fs, bNum, 1, block);
+        result = cacheWriteBlock(fs->cache, bNum, block) != 0 ? TFS_EIO : 0;
+    }
+    pthread_mutex_unlock(&fs->inodeLock);
+    if (result != 0) {
+        logError("Failed to clear inode %d.\n", ino);
+        return result; // failure (unable to clear inode)
+    }
+    if (empty) {
+        releaseBlocks(fs, bNum, 1);
+    }
+    return 0;
+}
+
+// copy the payloads of run blocks, the first holding file byte offset + copied, into
+// buffer. returns the new copied, which stops at size
+static int copyPayloads(char *blocks, int run, int offset, int copied, int size, char *buffer) {
+    for (int i = 0; i < run && copied < size; i++) {
+        int blockOffset = (offset + copied) % DATA_BLOCK_PAYLOAD;
+        if (blockOffset == 0 && size - copied >= DATA_BLOCK_PAYLOAD) {
+            memcpy(buffer + copied, &blocks[i * BLOCKSIZE + 4], DATA_BLOCK_PAYLOAD); // whole payload, constant size
+            copied += DATA_BLOCK_PAYLOAD;
+            continue;
         }
-        if (superblock[_NUM_FREE_BLOCKS] < 2) {
-            printf("Not enough blocks to create a new inode and file data.\n");
-            return -1;
+        int n = DATA_BLOCK_PAYLOAD - blockOffset;
+        if (n > size - copied) {
+            n = size - copied;
         }
+        memcpy(buffer + copied, &blocks[i * BLOCKSIZE + 4 + blockOffset], n);
+        copied += n;
+    }
+    return copied;
+}
 
-        char emptyBlock[BLOCKSIZE] = {0}; // empty block filled with 0s
-        emptyBlock[_BLOCK_TYPE] = 2; // inode block type
-        emptyBlock[_MAGIC_NUMBER] = 0x44; // magic number for inode block
-        
-        memcpy(&(emptyBlock[_NAME]), name, 8);
-        emptyBlock[_NAME + 8] = '\0';      
-        emptyBlock[_SIZE]= 0;
-        emptyBlock[_DATA_BLOCK] = -1; // no data yet
-        inodeIndex = superblock[_FREE_BLOCK_INDEX];
-        
-        printf("file: %s, freeblockindex: %d\n", name, superblock[_FREE_BLOCK_INDEX]);
-        writeBlock(mounted_disk, inodeIndex, emptyBlock);
-
-        superblock[_FREE_BLOCK_INDEX]++;
-        superblock[_NUM_FREE_BLOCKS]--;
-        writeBlock(mounted_disk, 0, superblock); //add updated write block
-
-        // printf("] tfs_openFile INODE INFO:\n");
-        // printf("    ] inode[_BLOCK_TYPE]: %d\n", emptyBlock[_BLOCK_TYPE]);
-        // printf("    ] inode[_MAGIC_NUMBER]: %x\n", emptyBlock[_MAGIC_NUMBER]);
-        // printf("    ] inode[_NAME]: %s\n", &emptyBlock[_NAME]);
-        // printf("] END tfs_openFile INODE INFO\n");
-    }
-
-    // check if file table is full
-   
-
-    // add entry to file table
-    fileTable[nextFileDescriptor].inodeBlock = inodeIndex; // 1 = root inode block
-    fileTable[nextFileDescriptor].inodeIndex = -1; //inodeIndex % INODES_PER_BLOCK; dont need
-    fileTable[nextFileDescriptor].filePointer = 0;
-
-    printf("fileTable inodeBlock: %d\n", fileTable[nextFileDescriptor].inodeBlock);
-    printf("fileTable inodeIndex: %d\n", fileTable[nextFileDescriptor].inodeIndex);
-    printf("fileTable filePointer: %d\n", fileTable[nextFileDescriptor].filePointer);
-
-
-    // return file descriptor
-    if (nextFileDescriptor < FILE_TABLE_SIZE){
-        return nextFileDescriptor++;
-    }
-
-    else{
-        for (int i = 0; i < FILE_TABLE_SIZE; i++){
-            if (recycle_fd[i] < 0){
-                recycle_fd[i] = 0;
-                return i;
+// readOpenFile's data. every data block holds DATA_BLOCK_PAYLOAD bytes after its 4 byte header. each extent
+// run is read with one call (up to IO_CHUNK_BLOCKS blocks) and every block is read exactly once.
+// *error is set if the read stopped early at a block that does not match its checksum
+static int readDataSync(TinyFS *fs, ExtentMap *extents, int offset, int size, char *buffer, int *error) {
+    char chunk[IO_CHUNK_BLOCKS * BLOCKSIZE];
+    int lastBlock = (offset + size - 1) / DATA_BLOCK_PAYLOAD;
+    int copied = 0;
+    while (copied < size) {
+        int fileBlock = (offset + copied) / DATA_BLOCK_PAYLOAD;
+        int run;
+        int diskBlock = extentMapLookup(extents, fileBlock, &run);
+        if (diskBlock == -1) {
+            break; // extent list shorter than the file size says
+        }
+        if (run > lastBlock - fileBlock + 1) {
+            run = lastBlock - fileBlock + 1;
+        }
+        if (run > IO_CHUNK_BLOCKS) {
+            run = IO_CHUNK_BLOCKS;
+        }
+
+        // a mapped disk is parsed in place, anything else is read into chunk
+        char *blocks = mapBlock(fs->disk, diskBlock);
+        if (blocks != NULL) {
+            statsCacheAccess(run, 0, 0);
+        } else {
+            if (cacheReadBlocks(fs->cache, diskBlock, run, chunk) != 0) {
+                logError("Failed to read blocks %d-%d.\n", diskBlock, diskBlock + run - 1);
+                break; // return what was read so far, or the failure if nothing was
             }
+            blocks = chunk;
+        }
+        if ((*error = checkRead(fs, diskBlock, run, blocks)) != 0) {
+            break; // nothing of a damaged run is returned
         }
+        copied = copyPayloads(blocks, run, offset, copied, size, buffer);
     }
+    return copied;
+}
 
-    printf("File table is full.\n");
-    return -1; // failure (File table full)
+// size bytes of a file's data (or compressed stream) from offset, from its inode when it
+// is kept inline, else through readDataSync. returns the bytes read, *error as for readDataSync
+static int readStream(TinyFS *fs, OpenFile *file, int offset, int size, char *buffer, int *error) {
+    if (file->inode[_INODE_FLAGS] & INODE_INLINE) {
+        int room = inodeBytes(fs) - _INLINE_DATA;
+        int n = offset >= room ? 0 : room - offset < size ? room - offset : size;
+        memcpy(buffer, &file->inode[_INLINE_DATA + offset], n);
+        return n;
+    }
+    return readDataSync(fs, &file->extents, offset, size, buffer, error);
 }
 
+// read the chunk map of a compressed file from the start of its data
+static int loadChunks(TinyFS *fs, OpenFile *file) {
+    int size = getInodeSize(file->inode);
+    int headerBytes = chunkHeaderBytes(size);
+    char *header = malloc(headerBytes + 1);
+    if (header == NULL) {
+        return TFS_ENOMEM; // failure (out of memory)
+    }
+    int error = 0;
+    int result = readStream(fs, file, 0, headerBytes, header, &error) == headerBytes
+        ? chunkMapParse(&file->chunks, size, header)
+        : (error != 0 ? error : TFS_EIO);
+    free(header);
+    return result;
+}
 
-int tfs_closeFile(fileDescriptor FD) {
-    // Implement closing a file in the TinyFS filesystem
-    if (!mounted) {
-        printf("No file system is currently mounted.\n");
-        return -1; // failure (no file system mounted)
+// find or create name and return its open file with one reference taken,
+// NULL on failure with the reason in *error. *created is set when a new file
+// was made. called with dirLock held, so lookup and create are one step
+static OpenFile *openByName(TinyFS *fs, char *name, int *created, int *error) {
+    // check if file already exists
+    char scratch[BLOCKSIZE];
+    char *inode;
+    int inodeIndex = dirLookup(fs->directory, name);
+    if (inodeIndex != -1) {
+        // the entry has to point at the inode of that name, otherwise the index is stale
+        if (inodeIndex / fs->inodesPerBlock >= fs->freeMap.nBits || (inode = peekInode(fs, inodeIndex, scratch)) == NULL) {
+            logError("Failed to read inode %d.\n", inodeIndex);
+            *error = TFS_EIO;
+            return NULL; // failure (unable to read inode block)
+        }
+        if (inode[_BLOCK_TYPE] != 2 || inode[_MAGIC_NUMBER] != 0x44 || strncmp(&inode[_NAME], name, MAX_NAME_LENGTH) != 0) {
+            logInfo("Directory entry for %s is stale, rebuilding directory.\n", name);
+            pthread_mutex_lock(&fs->inodeLock); // the inode map is redone too
+            pthread_mutex_lock(&fs->allocLock);
+            int rebuilt = dirClear(fs->directory) == 0 && rebuildDirectory(fs) == 0;
+            pthread_mutex_unlock(&fs->allocLock);
+            pthread_mutex_unlock(&fs->inodeLock);
+            if (!rebuilt) {
+                logError("Failed to rebuild directory.\n");
+                *error = TFS_ECORRUPT;
+                return NULL; // failure (unable to rebuild directory)
+            }
+            inodeIndex = dirLookup(fs->directory, name);
+        }
     }
+    // create a new inode for file since it doesn't exist, in a free slot
+    if (inodeIndex == -1) {
+        char emptyBlock[BLOCKSIZE] = {0}; // empty inode filled with 0s
+        emptyBlock[_BLOCK_TYPE] = 2; // inode block type
+        emptyBlock[_MAGIC_NUMBER] = 0x44; // magic number for inode block
 
-    if (FD < 0 || FD >= FILE_TABLE_SIZE) {
-        printf("The FD is invalid.\n");
-        return -1; // failure (Invalid file descriptor)
+        strncpy(&(emptyBlock[_NAME]), name, 8);
+        emptyBlock[_NAME + 8] = '\0';
+        setInodeSize(emptyBlock, 0);
+        setField(emptyBlock, _DATA_BLOCK, -1); // no data yet
+        setField(emptyBlock, _NUM_BLOCKS, 0);
+        setField(emptyBlock, _NUM_EXTENTS, 0);
+        setField(emptyBlock, _INDIRECT_BLOCK, 0);
+
+        inodeIndex = allocateInode(fs, emptyBlock);
+        if (inodeIndex < 0) {
+            *error = inodeIndex;
+            return NULL; // failure (no room for the inode, or unable to write it)
+        }
+        logDebug("file: %s, inode: %d\n", name, inodeIndex);
+        pthread_mutex_lock(&fs->allocLock); // a new directory block may be allocated
+        int inserted = dirInsert(fs->directory, name, inodeIndex);
+        pthread_mutex_unlock(&fs->allocLock);
+        if (inserted != 0) {
+            freeInode(fs, inodeIndex);
+            *error = TFS_ENOSPC;
+            return NULL; // failure (no room for another directory block)
+        }
+        *created = 1;
     }
 
-    //remove entry from file table
-    fileTable[FD].inodeBlock = -1;
-    fileTable[FD].inodeIndex = -1;
-    fileTable[FD].filePointer = -1;
-    recycle_fd[FD] = -1;
+    // files already open share one copy of the inode and extent list
+    OpenFile *file = openFileGet(&fs->fileTable, inodeIndex);
+    if (file == NULL) {
+        file = malloc(sizeof(OpenFile));
+        if (file == NULL) {
+            *error = TFS_ENOMEM;
+            return NULL; // failure (out of memory)
+        }
+        file->inodeNumber = inodeIndex;
+        int inodeBlock = inodeIndex / fs->inodesPerBlock;
+        if (cacheReadBlock(fs->cache, inodeBlock, scratch) != 0) {
+            free(file);
+            logError("Failed to read inode block %d.\n", inodeBlock);
+            *error = TFS_EIO;
+            return NULL; // failure (unable to read inode block)
+        }
+        if (checkRead(fs, inodeBlock, 1, scratch) != 0) {
+            free(file);
+            *error = TFS_ECHECKSUM;
+            return NULL; // failure (inode block damaged on disk)
+        }
+        memcpy(file->inode, &scratch[inodeOffset(fs, inodeIndex)], inodeBytes(fs));
+        if (extentMapLoad(fs->cache, file->inode, &file->extents) != 0) {
+            free(file);
+            logError("Failed to read extent list of inode %d.\n", inodeIndex);
+            *error = TFS_EIO;
+            return NULL; // failure (unable to read extent list)
+        }
+        chunkMapInit(&file->chunks);
+        if (file->inode[_INODE_FLAGS] & INODE_COMPRESSED) {
+            int loaded = loadChunks(fs, file);
+            if (loaded != 0) {
+                extentMapDestroy(&file->extents);
+                free(file);
+                logError("Failed to read chunk map of inode %d.\n", inodeIndex);
+                *error = loaded;
+                return NULL; // failure (unable to read where the chunks are)
+            }
+        }
+        openFileAdd(&fs->fileTable, file);
+    }
+    return file;
+}
 
-    return 0; // success
+
+// openByName as one change to the metadata
+static OpenFile *openInTx(TinyFS *fs, char *name, int *created, int *error) {
+    txBegin(fs);
+    pthread_mutex_lock(&fs->dirLock);
+    OpenFile *file = openByName(fs, name, created, error);
+    pthread_mutex_unlock(&fs->dirLock);
+    txEnd(fs);
+    return file;
 }
 
-int tfs_writeFile(fileDescriptor FD, char *buffer, int size) {
-    printf("entered tfs writefile with fd %d\n", FD);
-    printf("will write %s\n", buffer);
-    
-    // Implement writing to a file in the TinyFS filesystem
-    if (FD < 0 || FD >= FILE_TABLE_SIZE) {
-        printf("Invalid file descriptor.\n");
-        return -1; // failure (Invalid file descriptor)
+// fs_openFile without the counting
+static fileDescriptor openFD(TinyFS *fs, char *name) {
+    if (fs == NULL) {
+        return TFS_ENOTMOUNTED; // failure (no file system mounted)
     }
 
-    //read in inode from inode block on disk (to get name of the file of FD)
-    char inode[BLOCKSIZE];  // ptr to inode block
-    if (readBlock(mounted_disk, fileTable[FD].inodeBlock, inode) == -1){ //read in inode block
-        printf("Failed to read inode block.\n");
-        return -1; // failure (unable to read inode block)
+    if (name == NULL || strnlen(name, 8) == 0) {
+        return TFS_ENAME; // failure (no name given)
     }
 
-    // for(int i = 0; i < sizeof(inode); i++) {
-    //     printf("%c\n", inode[i]);
-    // }
-    
-    //get the name of the file for FD
-    char name[9] = {0};
-    printf("name is %s\n", name);
-    printf("we want to copy %s\t", &(inode[_NAME]));
-    printf("into source %s\n", name);
-    memcpy(name, &(inode[_NAME]), 9);
-    
-    printf("calling delete\n");
-    tfs_deleteFile(FD); //delete the file (so we can clear the blocks FD was using, sets them to free blocks, shifts everything over
-    printf("buffer after deletion: %s\n", buffer);
-    FD = tfs_openFile(name); //readd the file (so we can write to it again, and it will be at the end of the file table and contiguous!)
-    printf("fd after opening %d\n", FD);
-    //read in superblock to check if there are enough free blocks to write the file
-    char superblock[BLOCKSIZE] = {0};
-    int rb = readBlock(mounted_disk, 0, superblock);
-    if (rb == -1) {
-        printf("Failed to read superblock.\n");
-        return -1; // failure (unable to read superblock)
+    int error = TFS_OK;
+    int created = 0;
+    OpenFile *file = openInTx(fs, name, &created, &error);
+    if (file == NULL && error == TFS_ENOSPC && reclaimHeld(fs)) {
+        file = openInTx(fs, name, &created, &error);
+    }
+    if (file == NULL) {
+        return error; // failure (reason set by openByName)
+    }
+    error = commitChange(fs, created ? noteChange(fs) : 0);
+    if (error != 0) {
+        openFilePut(&fs->fileTable, file);
+        return error; // failure (the new file could not be made durable)
     }
 
-    int blocks_avail = superblock[_NUM_FREE_BLOCKS];
-    int blocks_needed = (sizeof(int) * size) / (BLOCKSIZE - 4);
-    if ((sizeof(int) * size) % (BLOCKSIZE - 4) != 0) {
-        blocks_needed++;
+    int fd = fdAlloc(&fs->fileTable, file);
+    if (fd == -1) {
+        openFilePut(&fs->fileTable, file);
+        return TFS_ENOMEM; // failure (File table could not grow)
     }
+    logDebug("fd %d -> inode %d\n", fd, file->inodeNumber);
+    return fd;
+}
 
-    if (blocks_needed > blocks_avail) {
-        printf("Not enough free blocks to write file.\n");
-        return -1; // failure (Not enough free blocks to write file)
+fileDescriptor fs_openFile(TinyFS *fs, char *name) {
+    StatsSpan span;
+    statsBegin(&span);
+    fileDescriptor fd = openFD(fs, name);
+    statsEnd(&span, STAT_OPEN, fd, fd, 0, 0);
+    return fd;
+}
+
+
+int fs_closeFile(TinyFS *fs, fileDescriptor FD) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = 0; // success
+    if (fs == NULL) {
+        result = TFS_ENOTMOUNTED; // failure (no file system mounted)
+    } else if (fdRelease(&fs->fileTable, FD) != 0) { //remove entry from file table
+        result = TFS_EBADFD; // failure (Invalid file descriptor)
     }
+    statsEnd(&span, STAT_CLOSE, FD, result, 0, 0);
+    return result;
+}
 
-    char* current_buffer = buffer;
-    printf("blocks_needed: %d\n", blocks_needed);
-    printf("current_buffer: %s\n", current_buffer);
+// open descriptor FD in *entry, fails if nothing is mounted, FD is not open or its file was deleted
+static int findFD(TinyFS *fs, fileDescriptor FD, FileTableEntry **entry) {
+    if (fs == NULL) {
+        return TFS_ENOTMOUNTED; // failure (no file system mounted)
+    }
+    *entry = fdGet(&fs->fileTable, FD);
+    if (*entry == NULL || (*entry)->file->inodeNumber < 1) {
+        return TFS_EBADFD; // failure (Invalid file descriptor)
+    }
+    return 0;
+}
 
+// make the cached extent list match the cached inode again after a failed update
+static void reloadExtents(TinyFS *fs, OpenFile *file) {
+    extentMapDestroy(&file->extents);
+    if (extentMapLoad(fs->cache, file->inode, &file->extents) != 0) {
+        logError("Failed to read extent list.\n");
+    }
+}
 
-    for (int i = 0; i<blocks_needed; i++) {
-        char block_data[BLOCKSIZE];
+// data blocks fileBlock .. fileBlock + run - 1 of a file holding buffer[0, size), built in blocks
+static void fillDataBlocks(char *blocks, int fileBlock, int run, char *buffer, int size) {
+    memset(blocks, 0, (size_t)run * BLOCKSIZE);
+    for (int i = 0; i < run; i++) {
+        char *block_data = &blocks[i * BLOCKSIZE];
         block_data[0] = 3;
         block_data[1] = 0x44;
-        block_data[2] = 0;
-        block_data[3] = 0;
+        int offset = (fileBlock + i) * DATA_BLOCK_PAYLOAD;
+        if (size - offset >= DATA_BLOCK_PAYLOAD) {
+            memcpy(&block_data[4], buffer + offset, DATA_BLOCK_PAYLOAD); // constant size, inlined by the compiler
+            continue;
+        }
+        memcpy(&block_data[4], buffer + offset, size - offset);
+    }
+}
 
-        // int bytes_to_copy = (size - i * (BLOCKSIZE - 4)) > (BLOCKSIZE - 4) ? (BLOCKSIZE - 4) : (size - i * (BLOCKSIZE - 4));
-        // memcpy(&block_data[4], current_buffer, bytes_to_copy);
-        // current_buffer += bytes_to_copy;
+// whether file blocks first .. first + count - 1 need more than one bulk call, the
+// case that goes through the async engine so all of them are in flight together
+static int spansChunks(TinyFS *fs, ExtentMap *extents, int first, int count) {
+    int run = 0;
+    if (fs->async == NULL || extentMapLookup(extents, first, &run) == -1) {
+        return 0;
+    }
+    return count > IO_CHUNK_BLOCKS || run < count;
+}
 
-        if (i != blocks_needed -1){ //copy 252 bytes into buffer
-            printf("destination: %s\n", &block_data[4]);
-            printf("source: %s\n", current_buffer);
-            memcpy(&block_data[4], current_buffer, 252);
-            current_buffer += 252;
+// writeOpenFile's data, one extent run at a time, IO_CHUNK_BLOCKS blocks per call
+static int writeDataSync(TinyFS *fs, ExtentMap *extents, char *buffer, int size, int blocks_needed) {
+    char chunk[IO_CHUNK_BLOCKS * BLOCKSIZE];
+    int fileBlock = 0;
+    while (fileBlock < blocks_needed) {
+        int run;
+        int diskBlock = extentMapLookup(extents, fileBlock, &run);
+        if (run > blocks_needed - fileBlock) {
+            run = blocks_needed - fileBlock;
         }
-        else{ //copy only the remaining bytes 
-            printf("destination: %s\n", &block_data[4]);
-            printf("source: %s\n", current_buffer);
-            memcpy(&block_data[4], current_buffer, (size % (BLOCKSIZE - 4)));
+        if (run > IO_CHUNK_BLOCKS) {
+            run = IO_CHUNK_BLOCKS;
         }
-        
-        printf("block # %d, text %c\n", i, current_buffer[0]);
 
-        writeBlock(mounted_disk, superblock[_FREE_BLOCK_INDEX], block_data);
-        superblock[_FREE_BLOCK_INDEX]++;
-        superblock[_NUM_FREE_BLOCKS]--;
+        fillDataBlocks(chunk, fileBlock, run, buffer, size);
+        noteWritten(fs, diskBlock, run, chunk);
+        if (cacheWriteBlocks(fs->cache, diskBlock, run, chunk) != 0) {
+            logError("Failed to write data blocks %d-%d.\n", diskBlock, diskBlock + run - 1);
+            return TFS_EIO; // failure (unable to write data block)
+        }
+        fileBlock += run;
     }
+    return 0;
+}
 
-    writeBlock(mounted_disk, 0, superblock); //add updated write block
-    
-    // int inode_offset = fileTable[FD].inodeIndex; not using anymore
-    inode[_SIZE] = size;
-    inode[_DATA_BLOCK] = superblock[_FREE_BLOCK_INDEX] - blocks_needed;
-    writeBlock(mounted_disk, fileTable[FD].inodeBlock, inode);
+// writeOpenFile's data through fs->async: up to ASYNC_BATCH_BLOCKS blocks are built,
+// submitted one extent run (or ASYNC_REQUEST_BLOCKS) per request, then waited for together
+static int writeDataAsync(TinyFS *fs, ExtentMap *extents, char *buffer, int size, int blocks_needed) {
+    int batchBlocks = blocks_needed < ASYNC_BATCH_BLOCKS ? blocks_needed : ASYNC_BATCH_BLOCKS;
+    char *blocks = malloc((size_t)batchBlocks * BLOCKSIZE);
+    if (blocks == NULL) {
+        return writeDataSync(fs, extents, buffer, size, blocks_needed); // no room for a batch, write in chunks
+    }
 
-    fileTable[FD].filePointer = 0;
-    return 0;   // added to compile TODO change
+    int result = 0;
+    int fileBlock = 0;
+    while (result == 0 && fileBlock < blocks_needed) {
+        AsyncBatch batch;
+        batchInit(&batch);
+        for (int n = 0; n < batchBlocks && fileBlock < blocks_needed; ) {
+            int run;
+            int diskBlock = extentMapLookup(extents, fileBlock, &run);
+            if (run > blocks_needed - fileBlock) {
+                run = blocks_needed - fileBlock;
+            }
+            if (run > batchBlocks - n) {
+                run = batchBlocks - n;
+            }
+            if (run > ASYNC_REQUEST_BLOCKS) {
+                run = ASYNC_REQUEST_BLOCKS;
+            }
+
+            char *request = &blocks[n * BLOCKSIZE];
+            fillDataBlocks(request, fileBlock, run, buffer, size);
+            noteWritten(fs, diskBlock, run, request);
+            cacheRefresh(fs->cache, diskBlock, run, request); // cached copies must not go stale
+            if (submitWrite(fs->async, &batch, diskBlock, run, request) != 0) {
+                result = TFS_EIO;
+                break; // still wait for what was submitted, it points into blocks
+            }
+            n += run;
+            fileBlock += run;
+        }
+        if (waitBatch(fs->async, &batch) != 0) {
+            logError("Failed to write data blocks of file block %d or before.\n", fileBlock - 1);
+            result = TFS_EIO; // failure (unable to write data block)
+        }
+    }
+    free(blocks);
+    return result;
 }
 
-int tfs_deleteFile(fileDescriptor FD) {
-    // Implement deleting a file in the TinyFS filesystem
-    if (FD < 0 || FD >= FILE_TABLE_SIZE) {
-        printf("Invalid file descriptor.\n");
-        return -1; // failure (Invalid file descriptor)
+// writeOpenFile's data: size bytes of buffer in the file's data blocks, with its extent
+// list sized to match and stored in the inode copy. data that fits in the inode in
+// place of the extent list is kept there instead, and spills into data blocks once it grows
+static int writeData(TinyFS *fs, OpenFile *file, char *buffer, int size) {
+    ExtentMap *extents = &file->extents;
+    int keepInline = size <= inodeBytes(fs) - _INLINE_DATA;
+    // the file keeps the blocks it already owns: only missing blocks are allocated, surplus ones are freed
+    int blocks_needed = keepInline ? 0 : (size + DATA_BLOCK_PAYLOAD - 1) / DATA_BLOCK_PAYLOAD;
+    pthread_mutex_lock(&fs->allocLock);
+    int resized = 0;
+    if (blocks_needed > extents->numBlocks) {
+        resized = extentMapGrow(extents, &fs->freeMap, blocks_needed - extents->numBlocks);
+    } else {
+        extentMapTruncate(extents, &fs->freeMap, blocks_needed);
+    }
+    pthread_mutex_unlock(&fs->allocLock);
+    if (resized != 0) {
+        return TFS_ENOSPC; // failure (Not enough free blocks to write file)
     }
 
-    //read in inode from inode block on disk (to get size of FD)
-    char inode[BLOCKSIZE];
-    if (readBlock(mounted_disk, fileTable[FD].inodeBlock, inode) == -1){ //read in inode block
-        printf("Failed to read inode block.\n");
-        return -1; // failure (unable to read inode block)
+    int written;
+    if (spansChunks(fs, extents, 0, blocks_needed)) {
+        written = writeDataAsync(fs, extents, buffer, size, blocks_needed);
+    } else {
+        written = writeDataSync(fs, extents, buffer, size, blocks_needed);
+    }
+    if (written != 0) {
+        reloadExtents(fs, file);
+        return written; // failure (unable to write data blocks)
     }
 
-    // int inode_start = fileTable[FD].inodeIndex; //gets the offset of the inode in the inode block
-    int file_bytes =  inode[_SIZE]; //i think size is in ints
+    pthread_mutex_lock(&fs->allocLock); // indirect extent blocks come from freeMap
+    int stored = extentMapStore(fs->cache, &fs->freeMap, file->inode, extents);
+    pthread_mutex_unlock(&fs->allocLock);
+    if (stored != 0) {
+        reloadExtents(fs, file);
+        logError("Failed to write extent list.\n");
+        return TFS_EIO; // failure (unable to write extent list)
+    }
+    if (keepInline) {
+        memcpy(&file->inode[_INLINE_DATA], buffer, size); // over the extent list, empty now
+        file->inode[_INODE_FLAGS] |= INODE_INLINE;
+    } else {
+        file->inode[_INODE_FLAGS] &= ~INODE_INLINE;
+    }
+    return 0;
+}
 
-    int file_blocks = (file_bytes / (BLOCKSIZE - 4)); //number of blocks the file takes up
-    if ( file_bytes % (BLOCKSIZE - 4) != 0) { //round up (if it does not fit block perfectly
-        file_blocks++;
+// tfs_writeFile with the file's lock held for writing
+static int writeOpenFile(TinyFS *fs, FileTableEntry *entry, char *buffer, int size) {
+    // inode and extent list come from the open file, nothing is read back from disk
+    OpenFile *file = entry->file;
+    if (file->inodeNumber < 1) {
+        return TFS_EBADFD; // failure (file deleted while waiting for the lock)
+    }
+    file->generation++; // prefetched blocks of the old contents are no longer used
+
+    // a compressed file's data blocks hold its compressed stream instead of buffer
+    char *data = buffer;
+    int dataSize = size;
+    ChunkMap chunks;
+    chunkMapInit(&chunks);
+    if ((file->inode[_INODE_FLAGS] & INODE_COMPRESSED) &&
+        compressStream(buffer, size, &data, &dataSize, &chunks) != 0) {
+        return TFS_ENOMEM; // failure (no room to compress into)
+    }
+    int written = writeData(fs, file, data, dataSize);
+    if (data != buffer) {
+        free(data);
     }
+    if (written != 0) {
+        chunkMapDestroy(&chunks);
+        return written; // failure (unable to write data or extent list)
+    }
+    chunkMapDestroy(&file->chunks);
+    file->chunks = chunks;
 
-    file_blocks++; //add one for the inode block! because were also getting rid of the inode block
+    setInodeSize(file->inode, size);
+    if (storeInode(fs, file->inodeNumber, file->inode) != 0) {
+        return TFS_EIO; // failure (unable to write inode block)
+    }
 
-    //delete from inode and the following file_blocks 
-    int first_block = fileTable[FD].inodeBlock ; // block # of first data block for FD
-    printf("DELETE_FILE: deleting this many blocks %d\n", file_blocks);
+    entry->filePointer = 0;
+    return 0; // success
+}
 
-    //read in super, to get root inode used in for-loop
-    char superblock[BLOCKSIZE];
-    int rb = readBlock(mounted_disk, 0, superblock);
-    if (rb == -1) {
-        printf("Failed to read superblock.\n");
-        return -1; // failure (unable to read superblock)
+// writeOpenFile as one change to the metadata
+static int writeInTx(TinyFS *fs, FileTableEntry *entry, char *buffer, int size) {
+    txBegin(fs);
+    pthread_rwlock_wrlock(&entry->file->lock);
+    int result = writeOpenFile(fs, entry, buffer, size);
+    pthread_rwlock_unlock(&entry->file->lock);
+    txEnd(fs);
+    return result;
+}
+
+int fs_writeFile(TinyFS *fs, fileDescriptor FD, char *buffer, int size) {
+    StatsSpan span;
+    statsBegin(&span);
+    FileTableEntry *entry = NULL;
+    int result = findFD(fs, FD, &entry);
+    if (result == 0 && (size < 0 || (buffer == NULL && size > 0))) {
+        result = TFS_EINVAL; // failure (bad buffer)
     }
+    if (result == 0) {
+        result = writeInTx(fs, entry, buffer, size);
+        if (result == TFS_ENOSPC && reclaimHeld(fs)) {
+            result = writeInTx(fs, entry, buffer, size);
+        }
+    }
+    if (result == 0) {
+        result = commitChange(fs, noteChange(fs));
+    }
+    statsEnd(&span, STAT_WRITE, FD, result, result == 0 ? size : 0, 0);
+    return result;
+}
+
+// tfs_deleteFile with the file's lock held for writing
+static int deleteOpenFile(TinyFS *fs, OpenFile *file) {
+    int inodeNumber = file->inodeNumber;
+    if (inodeNumber < 1) {
+        return TFS_EBADFD; // failure (file deleted while waiting for the lock)
+    }
+
+    //freeing only flips bits, the data blocks themselves are left alone
+    pthread_mutex_lock(&fs->allocLock);
+    extentMapTruncate(&file->extents, &fs->freeMap, 0);
+    while (file->extents.numIndirect > 0) {
+        bitmapClear(&fs->freeMap, file->extents.indirect[--file->extents.numIndirect], 1);
+    }
+    pthread_mutex_unlock(&fs->allocLock);
+
+    //drop the name first, then the inode is cleared so a rebuild no longer finds it.
+    //the open file is forgotten under dirLock too, so a new file given this inode number never finds it
+    char name[MAX_NAME_LENGTH + 1] = {0};
+    memcpy(name, &file->inode[_NAME], MAX_NAME_LENGTH);
+    pthread_mutex_lock(&fs->dirLock);
+    if (dirRemove(fs->directory, name) != 0) {
+        logError("Failed to remove directory entry %s.\n", name);
+    }
+    openFileForget(&fs->fileTable, file); // other descriptors still open on the file now report it as invalid
+    pthread_mutex_unlock(&fs->dirLock);
+
+    return freeInode(fs, inodeNumber); // 0 on success
+}
 
-    printf("free is at %d, first is at %d and is this long %d", superblock[_FREE_BLOCK_INDEX], first_block, file_blocks );
+int fs_deleteFile(TinyFS *fs, fileDescriptor FD) {
+    StatsSpan span;
+    statsBegin(&span);
+    FileTableEntry *entry = NULL;
+    int result = findFD(fs, FD, &entry);
+    if (result == 0) {
+        txBegin(fs);
+        pthread_rwlock_wrlock(&entry->file->lock);
+        result = deleteOpenFile(fs, entry->file);
+        pthread_rwlock_unlock(&entry->file->lock);
+        txEnd(fs);
+    }
+    if (result == 0) {
+        fdRelease(&fs->fileTable, FD);
+        result = commitChange(fs, noteChange(fs));
+    }
+    statsEnd(&span, STAT_DELETE, FD, result, 0, 0);
+    return result;
+}
 
-    //move all the files after the deleted file up (removes external fragmentation)
-    for (int i = first_block; i < superblock[_FREE_BLOCK_INDEX]-file_blocks; i++) {
-        printf("deleting block %d\n", i);
-        if (i + file_blocks < FILE_TABLE_SIZE){
-            fileTable[i] = fileTable[i + file_blocks];
-            //read block from disk that we want to move up (aka the data right after FD)
-            char block_data[BLOCKSIZE];
-            readBlock(mounted_disk, superblock[_ROOT_INODE_BLOCK] + file_blocks + i, block_data);         
-            writeBlock(mounted_disk, superblock[_ROOT_INODE_BLOCK] + i, block_data);
+// checkRead for n blocks read in file order from file block fileBlock on, one extent run at a time
+static int checkFileBlocks(TinyFS *fs, ExtentMap *extents, int fileBlock, int n, const char *blocks) {
+    for (int i = 0; fs->sums != NULL && i < n; ) {
+        int run;
+        int diskBlock = extentMapLookup(extents, fileBlock + i, &run);
+        if (run > n - i) {
+            run = n - i;
+        }
+        if (checkRead(fs, diskBlock, run, &blocks[i * BLOCKSIZE]) != 0) {
+            return TFS_ECHECKSUM; // failure (block damaged on disk)
         }
+        i += run;
     }
-    printf("flag - delete function \n");
+    return 0;
+}
 
-    //free all the blocks that should now be free
-    char freeBlock[BLOCKSIZE] = {0}; // empty block filled with 0s
-    freeBlock[0] = 4; // Signify free block
-    freeBlock[1] = 0x44; // Signify magic number
-    for (int i = superblock[_FREE_BLOCK_INDEX]; i < superblock[_FREE_BLOCK_INDEX] + file_blocks; i++) {
-        writeBlock(mounted_disk, i, freeBlock);
+// readOpenFile's data through fs->async: the runs of up to ASYNC_BATCH_BLOCKS blocks are
+// all submitted, then waited for together. runs with a block in the cache are read from it,
+// since a dirty cached block is newer than the disk. *error as for readDataSync
+static int readDataAsync(TinyFS *fs, ExtentMap *extents, int offset, int size, char *buffer, int *error) {
+    int lastBlock = (offset + size - 1) / DATA_BLOCK_PAYLOAD;
+    int fileBlock = offset / DATA_BLOCK_PAYLOAD;
+    int batchBlocks = lastBlock - fileBlock + 1 < ASYNC_BATCH_BLOCKS ? lastBlock - fileBlock + 1 : ASYNC_BATCH_BLOCKS;
+    char *blocks = malloc((size_t)batchBlocks * BLOCKSIZE);
+    if (blocks == NULL) {
+        return readDataSync(fs, extents, offset, size, buffer, error); // no room for a batch, read in chunks
     }
 
-    //update superblock
-    superblock[_NUM_FREE_BLOCKS] += file_blocks;
-    superblock[_FREE_BLOCK_INDEX] -= file_blocks;
-    writeBlock(mounted_disk, 0, superblock); //add updated write block
+    int copied = 0;
+    int failed = 0;
+    while (!failed && fileBlock <= lastBlock) {
+        AsyncBatch batch;
+        batchInit(&batch);
+        int n = 0; // blocks of this batch, all present and in file order
+        while (n < batchBlocks && fileBlock <= lastBlock) {
+            int run;
+            int diskBlock = extentMapLookup(extents, fileBlock, &run);
+            if (diskBlock == -1) {
+                failed = 1;
+                break; // extent list shorter than the file size says
+            }
+            if (run > lastBlock - fileBlock + 1) {
+                run = lastBlock - fileBlock + 1;
+            }
+            if (run > batchBlocks - n) {
+                run = batchBlocks - n;
+            }
+            if (run > ASYNC_REQUEST_BLOCKS) {
+                run = ASYNC_REQUEST_BLOCKS;
+            }
 
+            char *request = &blocks[n * BLOCKSIZE];
+            int result = cacheResident(fs->cache, diskBlock, run)
+                ? cacheReadBlocks(fs->cache, diskBlock, run, request)
+                : submitRead(fs->async, &batch, diskBlock, run, request);
+            if (result != 0) {
+                logError("Failed to read blocks %d-%d.\n", diskBlock, diskBlock + run - 1);
+                failed = 1;
+                break; // return what was read so far, or the failure if nothing was
+            }
+            n += run;
+            fileBlock += run;
+        }
+        if (waitBatch(fs->async, &batch) != 0) {
+            logError("Failed to read data blocks of file block %d or before.\n", fileBlock - 1);
+            break; // which request failed is not known, so nothing of this batch is kept
+        }
+        if ((*error = checkFileBlocks(fs, extents, fileBlock - n, n, blocks)) != 0) {
+            break; // nothing of a damaged batch is returned
+        }
+        copied = copyPayloads(blocks, n, offset, copied, size, buffer);
+    }
+    free(blocks);
+    return copied;
+}
 
-    //do we also remove entry from file table??
-    recycle_fd[FD] = -1;
-    fileTable[FD].inodeBlock = -1;
-    fileTable[FD].inodeIndex = -1;
-    fileTable[FD].filePointer = -1;
-    return 0; // TODO added to compile
+// make chunk index of a compressed file the one held by buffer: only its part of the
+// stream is read, and it is decompressed once for every read the descriptor makes in it
+static int loadChunk(TinyFS *fs, OpenFile *file, int index, ChunkBuffer *buffer) {
+    if (buffer->data == NULL) {
+        buffer->data = malloc(COMPRESS_CHUNK);
+        buffer->packed = malloc(COMPRESS_CHUNK);
+        if (buffer->data == NULL || buffer->packed == NULL) {
+            chunkBufferDrop(buffer);
+            return TFS_ENOMEM; // failure (out of memory)
+        }
+    }
+    buffer->index = -1;
+    int start = file->chunks.start[index];
+    int stored = file->chunks.start[index + 1] - start;
+    int error = 0;
+    if (readStream(fs, file, start, stored, buffer->packed, &error) != stored) {
+        return error != 0 ? error : TFS_EIO; // failure (unable to read the chunk)
+    }
+    int length = decompressChunk(&file->chunks, getInodeSize(file->inode), index, buffer->packed, buffer->data);
+    if (length < 0) {
+        logError("Chunk %d of inode %d is damaged.\n", index, file->inodeNumber);
+        return length; // failure (chunk does not decompress)
+    }
+    buffer->index = index;
+    buffer->generation = file->generation;
+    buffer->length = length;
+    return 0;
 }
 
-int tfs_readByte(fileDescriptor FD, char *buffer) {
-    // Implement reading a byte from a file in the TinyFS filesystem
-    if (FD < 0 || FD >= FILE_TABLE_SIZE) {
-        printf("Invalid file descriptor.\n");
-        return -1; // failure (Invalid file descriptor)
+// readOpenFile for a compressed file: size bytes from offset, through the descriptor's chunk buffer
+static int readCompressed(TinyFS *fs, FileTableEntry *entry, int offset, int size, char *buffer) {
+    OpenFile *file = entry->file;
+    ChunkBuffer *held = &entry->chunk;
+    int copied = 0;
+    while (copied < size) {
+        int index = (offset + copied) / COMPRESS_CHUNK;
+        if (held->index != index || held->generation != file->generation) {
+            int result = loadChunk(fs, file, index, held);
+            if (result != 0) {
+                return copied > 0 ? copied : result; // what was read so far, or the failure if nothing was
+            }
+        }
+        int inChunk = (offset + copied) % COMPRESS_CHUNK;
+        int n = held->length - inChunk < size - copied ? held->length - inChunk : size - copied;
+        memcpy(buffer + copied, held->data + inChunk, n);
+        copied += n;
     }
-    
-    char inode[BLOCKSIZE];  // ptr to inode block
-    
-    if (readBlock(mounted_disk, fileTable[FD].inodeBlock, inode) == -1){ //read in inode block
-        printf("Failed to read inode block.\n");
-        return -1; // failure (unable to read inode block)
+    return copied;
+}
+
+// tfs_readFile with the file's lock held for reading
+static int readOpenFile(TinyFS *fs, FileTableEntry *entry, char *buffer, int size) {
+    OpenFile *file = entry->file;
+    if (file->inodeNumber < 1) {
+        return TFS_EBADFD; // failure (file deleted while waiting for the lock)
+    }
+    int fileSize = getInodeSize(file->inode);
+
+    int offset = entry->filePointer;
+    if (offset < 0) {
+        return TFS_EINVAL; // failure (file pointer before the start of the file)
+    }
+    if (offset >= fileSize) {
+        return 0; // end of file
+    }
+    if (size > fileSize - offset) {
+        size = fileSize - offset;
+    }
+    if (file->inode[_INODE_FLAGS] & INODE_COMPRESSED) {
+        int copied = readCompressed(fs, entry, offset, size, buffer);
+        if (copied > 0) {
+            entry->filePointer += copied;
+        }
+        return copied; // number of bytes read, or the failure
+    }
+    if (file->inode[_INODE_FLAGS] & INODE_INLINE) {
+        int error = 0;
+        int copied = readStream(fs, file, offset, size, buffer, &error);
+        if (copied == 0) {
+            return TFS_ECORRUPT; // failure (size runs past the inline data)
+        }
+        entry->filePointer += copied;
+        return copied; // number of bytes read, no data block needed
+    }
+
+    // a sequential reader first gets what this descriptor prefetched, the rest comes from the disk
+    ReadAhead *ra = &entry->readAhead;
+    int sequential = fs->async != NULL && readAheadSequential(ra, offset);
+    int lastBlock = (offset + size - 1) / DATA_BLOCK_PAYLOAD;
+    int copied = 0;
+    while (sequential && copied < size) {
+        int fileBlock = (offset + copied) / DATA_BLOCK_PAYLOAD;
+        int count;
+        char *blocks = readAheadFind(ra, file->generation, fileBlock, &count);
+        if (blocks == NULL) {
+            break;
+        }
+        if (count > lastBlock - fileBlock + 1) {
+            count = lastBlock - fileBlock + 1;
+        }
+        statsCacheAccess(count, count, 0);
+        copied = copyPayloads(blocks, count, offset, copied, size, buffer);
+    }
+    int error = 0;
+    if (copied < size) {
+        int firstBlock = (offset + copied) / DATA_BLOCK_PAYLOAD;
+        if (spansChunks(fs, &file->extents, firstBlock, lastBlock - firstBlock + 1)) {
+            copied += readDataAsync(fs, &file->extents, offset + copied, size - copied, buffer + copied, &error);
+        } else {
+            copied += readDataSync(fs, &file->extents, offset + copied, size - copied, buffer + copied, &error);
+        }
+    }
+
+    if (copied == 0) {
+        return error != 0 ? error : TFS_EIO; // failure (unable to read block, or it was damaged)
+    }
+    entry->filePointer += copied;
+    ra->nextOffset = entry->filePointer;
+    if (sequential) {
+        int numBlocks = (fileSize + DATA_BLOCK_PAYLOAD - 1) / DATA_BLOCK_PAYLOAD;
+        readAheadNext(ra, fs->async, fs->cache, fs->sums, &file->extents, file->generation,
+                      (entry->filePointer - 1) / DATA_BLOCK_PAYLOAD, numBlocks);
+    }
+    return copied; // number of bytes read
+}
+
+// fs_readFile without the counting
+static int readFD(TinyFS *fs, fileDescriptor FD, char *buffer, int size) {
+    FileTableEntry *entry = NULL;
+    int result = findFD(fs, FD, &entry);
+    if (result != 0) {
+        return result; // failure (no file system or Invalid file descriptor)
+    }
+    if (buffer == NULL || size < 0) {
+        return TFS_EINVAL; // failure (bad buffer)
     }
 
-    int size = inode[_SIZE];
+    pthread_rwlock_rdlock(&entry->file->lock);
+    result = readOpenFile(fs, entry, buffer, size);
+    pthread_rwlock_unlock(&entry->file->lock);
+    return result;
+}
 
-    int offset = fileTable[FD].filePointer;
+int fs_readFile(TinyFS *fs, fileDescriptor FD, char *buffer, int size) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = readFD(fs, FD, buffer, size);
+    statsEnd(&span, STAT_READ, FD, result, result, 0);
+    return result;
+}
 
-    if (offset > size) {
-        printf("End of file reached.\n");
-        return -1;
+int fs_readByte(TinyFS *fs, fileDescriptor FD, char *buffer) {
+    StatsSpan span;
+    statsBegin(&span);
+    int result = readFD(fs, FD, buffer, 1);
+    if (result == 0) {
+        result = TFS_EEOF; // failure (End of file reached)
+    } else if (result > 0) {
+        result = 0;
     }
+    statsEnd(&span, STAT_READ_BYTE, FD, result, result == 0 ? 1 : 0, 0);
+    return result;
+}
 
-    int block_num = fileTable[FD].filePointer / (BLOCKSIZE-4);
+int fs_seek(TinyFS *fs, fileDescriptor FD, int offset) {
+    StatsSpan span;
+    statsBegin(&span);
+    FileTableEntry *entry = NULL;
+    int result = findFD(fs, FD, &entry);
+    if (result == 0 && offset < 0) {
+        result = TFS_EINVAL; // failure (offset before the start of the file)
+    }
+    if (result == 0) {
+        entry->filePointer = offset;
+    }
+    statsEnd(&span, STAT_SEEK, FD, result, 0, 0);
+    return result;
+}
 
-    char block[BLOCKSIZE];
-    if (readBlock(mounted_disk, block_num, block) != 0) {
-        printf("Failed to read block.\n");
-        return -1; // failure (unable to read block)
+// fs_setCompression with the file's lock held for writing: what the file holds is read
+// back and written again in the new form, the descriptor keeps its file pointer
+static int recompressOpenFile(TinyFS *fs, FileTableEntry *entry, int mode) {
+    OpenFile *file = entry->file;
+    if (file->inodeNumber < 1) {
+        return TFS_EBADFD; // failure (file deleted while waiting for the lock)
     }
-    *buffer = block[4+offset];
-    return 0;
-    
-    //I'm not sure if this is the correct way to read the file
+    int flags = file->inode[_INODE_FLAGS];
+    int wanted = mode == COMPRESS_LZ ? flags | INODE_COMPRESSED : flags & ~INODE_COMPRESSED;
+    if (wanted == flags) {
+        return 0; // already stored that way
+    }
+    int size = getInodeSize(file->inode);
+    char *data = malloc(size + 1);
+    if (data == NULL) {
+        return TFS_ENOMEM; // failure (no room for the file's data)
+    }
+    int pointer = entry->filePointer;
+    entry->filePointer = 0;
+    int result = size > 0 ? readOpenFile(fs, entry, data, size) : 0;
+    if (result == size) {
+        file->inode[_INODE_FLAGS] = (char)wanted;
+        result = writeOpenFile(fs, entry, data, size);
+        if (result != 0) {
+            file->inode[_INODE_FLAGS] = (char)flags;
+        }
+    } else if (result >= 0) {
+        result = TFS_EIO; // failure (file shorter than its size)
+    }
+    entry->filePointer = pointer;
+    free(data);
+    return result;
 }
 
-int tfs_seek(fileDescriptor FD, int offset) {
-    // Implement seeking within a file in the TinyFS filesystem
-    if (FD < 0 || FD >= FILE_TABLE_SIZE) {
-        printf("Invalid file descriptor.\n");
-        return -1; // failure (Invalid file descriptor)
+// recompressOpenFile as one change to the metadata
+static int recompressInTx(TinyFS *fs, FileTableEntry *entry, int mode) {
+    txBegin(fs);
+    pthread_rwlock_wrlock(&entry->file->lock);
+    int result = recompressOpenFile(fs, entry, mode);
+    pthread_rwlock_unlock(&entry->file->lock);
+    txEnd(fs);
+    return result;
+}
+
+int fs_setCompression(TinyFS *fs, fileDescriptor FD, int mode) {
+    StatsSpan span;
+    statsBegin(&span);
+    FileTableEntry *entry = NULL;
+    int result = findFD(fs, FD, &entry);
+    if (result == 0 && mode != COMPRESS_NONE && mode != COMPRESS_LZ) {
+        result = TFS_EINVAL; // failure (unknown compression mode)
     }
-    fileTable[FD].filePointer = offset;
-    return 0; // success
+    if (result == 0) {
+        result = recompressInTx(fs, entry, mode);
+        if (result == TFS_ENOSPC && reclaimHeld(fs)) {
+            result = recompressInTx(fs, entry, mode);
+        }
+    }
+    if (result == 0) {
+        result = commitChange(fs, noteChange(fs));
+    }
+    statsEnd(&span, STAT_COMPRESS, FD, result, 0, 0);
+    return result;
 }
 
-// DEBUGGING
-int tfs_get_mounted_disk( ) {
-    return mounted_disk;
+// the original single-disk API, every call goes to defaultFS
+
+int tfs_mount(char *diskname) {
+    if (defaultFS != NULL) {
+        return TFS_EMOUNTED; // failure (file system already mounted) so return neg
+    }
+    int error = TFS_OK;
+    defaultFS = mountDisk(diskname, 0, &error);
+    return error;
 }
 
-/* Read the Superblock */
-//   char superblock[BLOCKSIZE];
-//   rb = readBlock(MOUNTED_DISK, 0, superblock);
+int tfs_mountMapped(char *diskname) {
+    if (defaultFS != NULL) {
+        return TFS_EMOUNTED; // failure (file system already mounted)
+    }
+    int error = TFS_OK;
+    defaultFS = mountDisk(diskname, 1, &error);
+    return error;
+}
 
-//   Inode inode;
-// (readBlock(mounted_disk, entry.inodeBlock, &inode) != 0)
\ No newline at end of file
+int tfs_unmount(void) {
+    int result = fs_unmount(defaultFS);
+    defaultFS = NULL; // gone even if closing the disk failed
+    return result;
+}
+
+int tfs_sync(void) {
+    return fs_sync(defaultFS);
+}
+
+fileDescriptor tfs_openFile(char *name) {
+    return fs_openFile(defaultFS, name);
+}
+
+int tfs_closeFile(fileDescriptor FD) {
+    return fs_closeFile(defaultFS, FD);
+}
+
+int tfs_writeFile(fileDescriptor FD, char *buffer, int size) {
+    return fs_writeFile(defaultFS, FD, buffer, size);
+}
+
+int tfs_deleteFile(fileDescriptor FD) {
+    return fs_deleteFile(defaultFS, FD);
+}
+
+int tfs_readFile(fileDescriptor FD, char *buffer, int size) {
+    return fs_readFile(defaultFS, FD, buffer, size);
+}
+
+int tfs_readByte(fileDescriptor FD, char *buffer) {
+    return fs_readByte(defaultFS, FD, buffer);
+}
+
+int tfs_seek(fileDescriptor FD, int offset) {
+    return fs_seek(defaultFS, FD, offset);
+}
+
+int tfs_setCompression(fileDescriptor FD, int mode) {
+    return fs_setCompression(defaultFS, FD, mode);
+}
+
+const char *tfs_strerror(int code) {
+    switch (code) {
+    case TFS_OK: return "success";
+    case TFS_EINVAL: return "invalid argument";
+    case TFS_ENOTMOUNTED: return "no file system mounted";
+    case TFS_EMOUNTED: return "a file system is already mounted";
+    case TFS_EBADFD: return "invalid file descriptor";
+    case TFS_ENAME: return "invalid file name";
+    case TFS_ENOSPC: return "not enough free blocks";
+    case TFS_ENOMEM: return "out of memory";
+    case TFS_EIO: return "disk I/O error";
+    case TFS_EOPEN: return "unable to open disk";
+    case TFS_EFORMAT: return "not a TinyFS disk";
+    case TFS_EVERSION: return "unsupported disk format or block size";
+    case TFS_ECORRUPT: return "file system is damaged";
+    case TFS_EEOF: return "end of file";
+    case TFS_ECHECKSUM: return "block checksum mismatch";
+    }
+    return "unknown error";
+}
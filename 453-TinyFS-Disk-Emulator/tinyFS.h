@@ -1,72 +1,173 @@
+#ifndef TINYFS_H
+#define TINYFS_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "libDisk.h" // Include the disk emulator library
+#include "blockCache.h"
+#include "TinyFS_errno.h"
+#include "stats.h" // tfs_stats and tracing
 
-#define BLOCKSIZE 256
-#define DEFAULT_DISK_SIZE 10240
-#define BLOCK_COUNT (DEFAULT_DISK_SIZE / BLOCKSIZE)
+#define DEFAULT_DISK_SIZE (40 * BLOCKSIZE) // size tfs_mkfs callers use by default, a mounted disk's size comes from its superblock
 #define DEFAULT_DISK_NAME "tinyFSDisk"
 #define SUPERBLOCK_BLOCK_NUM 0
+#define TFS_VERSION 9 // on-disk format written by this code (0 = original images, 2 = extent inodes, 3 = all counters 32-bit little-endian, 4 = block size recorded, 5 = metadata journal, 6 = block checksums, 7 = compressed files, 8 = inline data, 9 = inode table)
+#define BLOCK_SHIFT __builtin_ctz(BLOCKSIZE) // log2 of the block size this build uses
 
 #define INODE_BLOCK_SIZE 1
-#define INODE_SIZE sizeof(Inode)
+#define INODE_SIZE 128 // bytes per inode on disks with an inode map, the fields below take the first _INODE_SIZE
 #define INODES_PER_BLOCK (BLOCKSIZE / INODE_SIZE)
 
 //macros for super block (which is at block 0)
+//every int field in the on-disk format is 32-bit little-endian, read and written with getField/setField
 #define _BLOCK_TYPE 0
 #define _MAGIC_NUMBER 1 
-//bytes 2 and 3 empty
-#define _ROOT_INODE_BLOCK 4 //int, where the inode blocks start (inodes could be mixed in w data blocks)
-#define _FREE_BLOCK_INDEX 8 //int, where the free blocks start
-#define _NUM_FREE_BLOCKS  12 //int, total free blocks
+#define _FS_VERSION 2 //byte, on-disk format version (0 on images made before versioning)
+#define _BLOCK_SHIFT 3 //byte, log2 of the block size the disk was made with (0 on images before version 4, which use 256)
+#define _ROOT_INODE_BLOCK 4 //int, first block of the root directory (0 on images made before the directory existed)
+#define _FREE_BLOCK_INDEX 8 //int, lowest free block (a single byte on images before version 3)
+#define _NUM_FREE_BLOCKS  12 //int, total free blocks (a single byte on images before version 3)
+#define _TOTAL_BLOCKS 16 //int, number of blocks on the disk (0 on images made before the free-block bitmap)
+#define _BITMAP_BLOCKS 20 //int, number of bitmap overflow blocks, they follow the superblock
+#define _BITMAP 24 //free-block bitmap, 1 bit per block (1 = in use), continued in the overflow blocks
+
+#define SUPERBLOCK_BITMAP_BITS ((BLOCKSIZE - _BITMAP) * 8) // blocks tracked by the superblock itself
+#define BITMAP_BLOCK_BITS ((BLOCKSIZE - 4) * 8) // blocks tracked by each overflow block (after the 4 byte header)
 
 //macros for inode
+//inode blocks (block type 2) of disks with an inode map hold INODES_PER_BLOCK inodes of INODE_SIZE bytes,
+//inode number = block * INODES_PER_BLOCK + slot. every slot starts with the block type and magic number,
+//a free one has an empty name. older disks give each inode a whole block, numbered by the block.
+//the offsets below are from the start of the inode
 // #define _BLOCK_TYPE 0
 // #define _MAGIC_NUMBER 1 
+#define _INODE_FORMAT 2 //byte, 0 = original inode (single byte fields, one contiguous run), 2 = extent inode
+#define _INODE_FLAGS 3 //byte, INODE_* bits (0 on inodes made before version 7)
+#define INODE_COMPRESSED 1 //the data blocks hold the chunked compressed stream described in compress.h, _SIZE is the uncompressed size
+#define INODE_INLINE 2 //no data blocks or extents, the data (or compressed stream) is at _INLINE_DATA
 #define _NAME 4 //char[9], file name
 #define _SIZE 13 //int, file size
 #define _DATA_BLOCK 17 //int, block number of the first data block
-#define _INODE_SIZE 17 // 9 + 4 + 4
+#define _NUM_BLOCKS 21 //int, data blocks owned by the file
+#define _NUM_EXTENTS 25 //int, entries in the file's extent list
+#define _INDIRECT_BLOCK 29 //int, first indirect extent block (0 if all extents are inline)
+#define _EXTENTS 33 //first INLINE_EXTENTS extents, each an int pair (start block, length)
+#define INLINE_EXTENTS 8
+#define _INODE_SIZE (_EXTENTS + INLINE_EXTENTS * 8)
+#define _INLINE_DATA _EXTENTS //data of a small file in place of its extent list, up to the end of the inode
 
+//indirect extent blocks (block type 6) chain the extents that do not fit in the inode
+#define _NEXT_INDIRECT 4 //int, next indirect extent block (0 if last)
+#define _INDIRECT_EXTENTS 8
+#define EXTENTS_PER_INDIRECT ((BLOCKSIZE - _INDIRECT_EXTENTS) / 8)
 
-typedef struct {
-    int inodeBlock; // block number of the inode block containing this file's inode
-    int inodeIndex; // index of the inode within its block
-    int filePointer; // current position of the file pointer
-} FileTableEntry;
+//directory blocks (block type 7) hold the root directory entries, see directory.h
+#define _NEXT_DIR_BLOCK 4 //int, next directory block (0 if last)
+#define _DIR_ENTRIES 8 //DIR_ENTRIES_PER_BLOCK entries: char[9] name ("" for a free slot), int inode number at +12
+#define DIR_ENTRY_SIZE 16
+#define DIR_ENTRIES_PER_BLOCK ((BLOCKSIZE - _DIR_ENTRIES) / DIR_ENTRY_SIZE)
+#define MAX_NAME_LENGTH 8 // longer names are cut to this many characters
 
-#define FILE_TABLE_SIZE 10 // max # of open files
+//checksum table (version 6 disks made with one): blocks 1 + _BITMAP_BLOCKS onwards (block type 11),
+//enough of them for a CRC32C of every disk block, see checksum.h. 0 = no checksum recorded
+#define _SUMS 4 //SUMS_PER_BLOCK ints, the checksums of consecutive disk blocks
+#define SUMS_PER_BLOCK ((BLOCKSIZE - _SUMS) / 4)
 
-// superblock structure (I think this is how to implement it?)
-typedef struct {
-    unsigned char blockType;    // DO NOT DELETE. STRUCT READ FROM TOP TO BOTTOM. THIS IS NEEDED
-    unsigned char magicNumber; // magic # for file system detection
-    int rootInodeBlock; // block # of the root inode
-    int freeBlockIndex; // index of the next free block
-    int numFreeBlocks; 
-    unsigned char freeSpace[BLOCKSIZE]; //need enough space to read a full block
-} Superblock; 
+//metadata journal (version 5 disks made with one): the block after the bitmap blocks and the checksum
+//table is the journal header (block type 8), followed by the journal's record blocks, then the inode map
+#define _JOURNAL_BLOCKS 4 //int, blocks in the journal, header included
+#define _JOURNAL_SEQUENCE 8 //int, sequence number of the first transaction to replay
+#define _JOURNAL_TAIL 12 //int, journal block (counted from the header) where that transaction starts
+//a transaction is one or more descriptor blocks (type 9), each followed by the images of the
+//blocks it lists, then a commit block (type 10). replay stops at the first incomplete one
+#define _RECORD_SEQUENCE 4 //int, transaction sequence number (descriptor and commit blocks)
+#define _RECORD_COUNT 8 //int, descriptor: images that follow it. commit: blocks of the transaction before it
+#define _RECORD_TARGETS 12 //descriptor: an int per image, the block it is a copy of
+#define _RECORD_CHECKSUM 12 //commit: int, CRC32C of every block of the transaction before it
+#define RECORD_TARGETS_PER_BLOCK ((BLOCKSIZE - _RECORD_TARGETS) / 4)
 
+//inode map (version 9 disks): the blocks after the journal (block type 12), enough of them for a bit per
+//inode number, then the directory. a clear bit is a free slot in an inode block, every other bit is set
+#define _INODE_MAP_BITS 4 //bits from here on, in the order of bitmapStore
+#define INODE_MAP_BLOCK_BITS ((BLOCKSIZE - _INODE_MAP_BITS) * 8)
 
-// inode structure (I think this is how to implement it?)
-typedef struct {
-    char name[9]; // file name (up to 8 char)
-    int size; // file size
-    int dataBlock; // block number of the first data block
-} Inode;
+//data blocks: bytes 0-3 are the block header, the rest is file data
+#define DATA_BLOCK_PAYLOAD (BLOCKSIZE - 4)
+#define IO_CHUNK_BLOCKS (BLOCKSIZE < 8192 ? 8192 / BLOCKSIZE : 1) // most data blocks moved by one bulk read or write
+#define ASYNC_REQUEST_BLOCKS (IO_CHUNK_BLOCKS * 8) // most data blocks in one asynchronous request
+#define ASYNC_BATCH_BLOCKS (ASYNC_REQUEST_BLOCKS * 16) // most data blocks a read or write keeps in flight
 
 typedef int fileDescriptor;
 
+// every call returns 0 (or a descriptor / byte count) on success and a negative
+// TinyFS_errno.h code on failure. nothing is printed unless built with LOG_LEVEL > 0.
+
+// the tfs_* file calls may be made from several threads at once: each open file has a
+// reader/writer lock, the allocator and the directory have their own, and block I/O
+// uses pread/pwrite. a descriptor is used by one thread at a time, and mounting,
+// unmounting and tfs_configureCache must not overlap other calls on the same disk.
+
 int tfs_mkfs(char *filename, int nBytes);
+int tfs_configureCache(int nBlocks, int policy); // applies to later mounts, nBlocks == 0 disables caching
+
+// when metadata changes (files created, written or deleted) reach stable storage.
+// file data is written to the disk file during the call in every mode, and is
+// durable together with the metadata. tfs_sync and unmount always commit everything
+#define COMMIT_ON_SYNC 0   // only at tfs_sync, unmount or cache eviction: a crash loses every change since the last sync
+#define COMMIT_INTERVAL 1  // also every intervalMs from a background thread: a crash loses at most about that much
+#define COMMIT_EACH_CALL 2 // before the call returns: calls running at the same time share one flush
+#define DEFAULT_COMMIT_INTERVAL 100 // ms
+int tfs_configureCommit(int mode, int intervalMs); // applies to later mounts
+
+// metadata journal reserved by tfs_mkfs. with one, every commit first logs the changed
+// superblock, bitmap, inode and directory blocks as one transaction, replayed at mount
+// after a crash, so the metadata is always as of some commit. file data is not logged
+#define JOURNAL_AUTO -1 // 1/32 of the disk, at most 1024 blocks, none below JOURNAL_MIN_BLOCKS
+#define JOURNAL_MIN_BLOCKS 8
+int tfs_configureJournal(int nBlocks); // journal size used by later tfs_mkfs calls: JOURNAL_AUTO, 0 = none or at least JOURNAL_MIN_BLOCKS
+
+// block checksums kept by disks tfs_mkfs makes from now on. with CHECKSUM_BLOCK every data and
+// inode block gets a CRC32C when it is written, checked whenever it is read back: a block
+// damaged on disk fails the read with TFS_ECHECKSUM instead of returning bad data
+#define CHECKSUM_NONE 0
+#define CHECKSUM_BLOCK 1
+int tfs_configureChecksums(int mode);
+
+// compression of a file's data, see compress.h. with COMPRESS_LZ the file is stored in
+// COMPRESS_CHUNK byte chunks compressed one by one, and a read (after a seek or not)
+// decompresses only the chunks it touches. setting it rewrites what the file holds
+#define COMPRESS_NONE 0
+#define COMPRESS_LZ 1
+
+// one mounted disk. any number can be mounted at once, each call works on the disk it is given
+typedef struct TinyFS TinyFS;
+
+TinyFS *fs_mount(char *diskname); // NULL on failure
+TinyFS *fs_mountMapped(char *diskname); // mount with the whole image mmap'd instead of cached
+int fs_unmount(TinyFS *fs);
+fileDescriptor fs_openFile(TinyFS *fs, char *name);
+int fs_closeFile(TinyFS *fs, fileDescriptor FD);
+int fs_writeFile(TinyFS *fs, fileDescriptor FD, char *buffer, int size);
+int fs_deleteFile(TinyFS *fs, fileDescriptor FD);
+int fs_readByte(TinyFS *fs, fileDescriptor FD, char *buffer);
+int fs_readFile(TinyFS *fs, fileDescriptor FD, char *buffer, int size); // returns bytes read, 0 at end of file
+int fs_seek(TinyFS *fs, fileDescriptor FD, int offset);
+int fs_setCompression(TinyFS *fs, fileDescriptor FD, int mode); // COMPRESS_NONE or COMPRESS_LZ
+int fs_sync(TinyFS *fs); // commit: write back all dirty cached blocks of the disk and fsync it
+
+// the original API, working on a single default disk
 int tfs_mount(char *diskname);
+int tfs_mountMapped(char *diskname); // mount with the whole image mmap'd instead of cached
 int tfs_unmount(void);
 fileDescriptor tfs_openFile(char *name);
 int tfs_closeFile(fileDescriptor FD);
 int tfs_writeFile(fileDescriptor FD, char *buffer, int size);
 int tfs_deleteFile(fileDescriptor FD);
 int tfs_readByte(fileDescriptor FD, char *buffer);
+int tfs_readFile(fileDescriptor FD, char *buffer, int size); // returns bytes read, 0 at end of file
 int tfs_seek(fileDescriptor FD, int offset);
+int tfs_setCompression(fileDescriptor FD, int mode); // COMPRESS_NONE or COMPRESS_LZ
+int tfs_sync(void); // commit: write back all dirty cached blocks of the mounted disk and fsync it
 
-// TODO Remove these
-int tfs_get_mounted_disk( );
\ No newline at end of file
+#endif
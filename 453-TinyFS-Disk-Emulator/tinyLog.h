@@ -0,0 +1,23 @@
+#ifndef TINYLOG_H
+#define TINYLOG_H
+
+#include <stdio.h>
+
+// leveled logging to stderr. the level is fixed at build time (make LOG_LEVEL=3);
+// calls above it are dead code the compiler drops, so their arguments are never
+// formatted or even evaluated, but they are still type checked
+#define LOG_NONE 0
+#define LOG_ERROR 1 // a call failed, the error code says why and this says where
+#define LOG_INFO 2  // mount / unmount and other rare events
+#define LOG_DEBUG 3 // per call and per block detail
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_NONE
+#endif
+
+#define tfsLog(level, ...) do { if ((level) <= LOG_LEVEL) fprintf(stderr, __VA_ARGS__); } while (0)
+#define logError(...) tfsLog(LOG_ERROR, __VA_ARGS__)
+#define logInfo(...) tfsLog(LOG_INFO, __VA_ARGS__)
+#define logDebug(...) tfsLog(LOG_DEBUG, __VA_ARGS__)
+
+#endif
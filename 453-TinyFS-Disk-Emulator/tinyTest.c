@@ -1,5 +1,709 @@
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "tinyFS.h"
+#include "inode.h"
+#include "checksum.h"
+#include "compress.h"
+
+#define TEST_THREADS 4
+#define THREAD_ROUNDS 40
+#define THREAD_FILE_BYTES (3 * BLOCKSIZE)
+#define SHARED_FILE_BYTES (2 * BLOCKSIZE)
+#define GROW_FILES 40 // descriptors the table has to grow for, well past its first 16
+
+typedef struct {
+    TinyFS *fs;
+    int id;
+    int failures;
+} ThreadTest;
+
+// contents of a worker's own file after a round, so the final ones can be checked afterwards
+static int threadFill(int id, int round, char *data) {
+    int size = 1 + (round * 131 + id * 17) % THREAD_FILE_BYTES;
+    for (int i = 0; i < size; i++) {
+        data[i] = 'A' + (id * 7 + round + i) % 26;
+    }
+    return size;
+}
+
+// whole-file rewrites of the shared file hold the file lock, so a read sees one writer's run only
+static int sharedIntact(char *data, int size) {
+    if (size != SHARED_FILE_BYTES || data[0] < 'a' || data[0] >= 'a' + TEST_THREADS) {
+        return 0;
+    }
+    for (int i = 1; i < size; i++) {
+        if (data[i] != data[0]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// open / write / read / seek / delete on the worker's own file, the shared one and a temporary one
+static void *fileWorker(void *arg) {
+    ThreadTest *t = arg;
+    char name[MAX_NAME_LENGTH + 1];
+    char data[THREAD_FILE_BYTES];
+    char back[THREAD_FILE_BYTES];
+    snprintf(name, sizeof(name), "own%d", t->id);
+    fileDescriptor own = fs_openFile(t->fs, name);
+    fileDescriptor shared = fs_openFile(t->fs, "shared");
+    if (own < 0 || shared < 0) {
+        t->failures++;
+        return NULL;
+    }
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        int size = threadFill(t->id, round, data);
+        char byte;
+        if (fs_writeFile(t->fs, own, data, size) != 0 || fs_readFile(t->fs, own, back, size) != size ||
+            memcmp(data, back, size) != 0 || fs_seek(t->fs, own, size / 2) != 0 ||
+            fs_readByte(t->fs, own, &byte) != 0 || byte != data[size / 2]) {
+            t->failures++;
+        }
+
+        memset(data, 'a' + t->id, SHARED_FILE_BYTES);
+        if (fs_writeFile(t->fs, shared, data, SHARED_FILE_BYTES) != 0 || fs_seek(t->fs, shared, 0) != 0 ||
+            !sharedIntact(back, fs_readFile(t->fs, shared, back, SHARED_FILE_BYTES))) {
+            t->failures++;
+        }
+
+        snprintf(name, sizeof(name), "tmp%d", t->id);
+        fileDescriptor tmp = fs_openFile(t->fs, name);
+        if (tmp < 0 || fs_writeFile(t->fs, tmp, data, 1 + round % BLOCKSIZE) != 0 || fs_deleteFile(t->fs, tmp) != 0) {
+            t->failures++;
+        }
+    }
+    if (fs_closeFile(t->fs, own) != 0 || fs_closeFile(t->fs, shared) != 0) {
+        t->failures++;
+    }
+    return NULL;
+}
+
+// keeps GROW_FILES descriptors open at once while the workers run, so the file table grows under them
+static void *tableGrower(void *arg) {
+    ThreadTest *t = arg;
+    fileDescriptor fds[GROW_FILES];
+    for (int i = 0; i < GROW_FILES; i++) {
+        char name[MAX_NAME_LENGTH + 1];
+        snprintf(name, sizeof(name), "grow%d", i);
+        fds[i] = fs_openFile(t->fs, name);
+        char byte = (char)i;
+        if (fds[i] < 0 || fs_writeFile(t->fs, fds[i], &byte, 1) != 0) {
+            t->failures++;
+        }
+    }
+    for (int i = 0; i < GROW_FILES; i++) {
+        char byte;
+        if (fs_seek(t->fs, fds[i], 0) != 0 || fs_readByte(t->fs, fds[i], &byte) != 0 || byte != (char)i ||
+            fs_closeFile(t->fs, fds[i]) != 0) {
+            t->failures++;
+        }
+    }
+    return NULL;
+}
+
+// every worker's last write, and a shared file holding one writer's run, after the threads are done
+static int checkThreadFiles(TinyFS *fs) {
+    char data[THREAD_FILE_BYTES];
+    char back[THREAD_FILE_BYTES];
+    for (int id = 0; id < TEST_THREADS; id++) {
+        char name[MAX_NAME_LENGTH + 1];
+        snprintf(name, sizeof(name), "own%d", id);
+        int size = threadFill(id, THREAD_ROUNDS - 1, data);
+        fileDescriptor fd = fs_openFile(fs, name);
+        if (fd < 0 || fs_readFile(fs, fd, back, THREAD_FILE_BYTES) != size || memcmp(data, back, size) != 0) {
+            return -1;
+        }
+        fs_closeFile(fs, fd);
+    }
+    fileDescriptor fd = fs_openFile(fs, "shared");
+    if (fd < 0 || !sharedIntact(back, fs_readFile(fs, fd, back, THREAD_FILE_BYTES))) {
+        return -1;
+    }
+    fs_closeFile(fs, fd);
+    return 0;
+}
+
+// several threads on one journaled disk with a background flusher, checked again after a remount
+static int threadTest(void) {
+    char *disk = "threads.dsk";
+    tfs_configureJournal(JOURNAL_MIN_BLOCKS * 4);
+    tfs_configureCommit(COMMIT_INTERVAL, 5);
+    int result = tfs_mkfs(disk, 256 * BLOCKSIZE);
+    TinyFS *fs = result == 0 ? fs_mount(disk) : NULL;
+    tfs_configureJournal(JOURNAL_AUTO);
+    tfs_configureCommit(COMMIT_ON_SYNC, 0);
+    if (fs == NULL) {
+        return -1;
+    }
+
+    pthread_t threads[TEST_THREADS + 1];
+    ThreadTest tests[TEST_THREADS + 1];
+    for (int i = 0; i <= TEST_THREADS; i++) {
+        tests[i].fs = fs;
+        tests[i].id = i;
+        tests[i].failures = 0;
+        pthread_create(&threads[i], NULL, i < TEST_THREADS ? fileWorker : tableGrower, &tests[i]);
+    }
+    int failures = 0;
+    for (int i = 0; i <= TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        failures += tests[i].failures;
+    }
+    if (failures > 0 || checkThreadFiles(fs) != 0 || fs_unmount(fs) != 0) {
+        return -1;
+    }
+
+    fs = fs_mount(disk);
+    if (fs == NULL || checkThreadFiles(fs) != 0) {
+        return -1;
+    }
+    return fs_unmount(fs);
+}
+
+// every block of a disk image, read with libDisk while nothing has it mounted
+static char *readImage(char *name, int nBlocks) {
+    char *image = malloc((size_t)nBlocks * BLOCKSIZE);
+    int disk = openDisk(name, 0);
+    int result = image == NULL || disk < 0 ? -1 : readBlocks(disk, 0, nBlocks, image);
+    if (disk >= 0) {
+        closeDisk(disk);
+    }
+    if (result != 0) {
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+// tfs_mkfs on a new disk file: free blocks are never written, so the tests that scan the
+// raw image must not find blocks left there by an earlier run
+static int freshDisk(char *name, int nBytes) {
+    remove(name);
+    return tfs_mkfs(name, nBytes);
+}
+
+static int writeImage(char *name, int nBlocks, char *image) {
+    int disk = openDisk(name, 0);
+    if (disk < 0) {
+        return disk;
+    }
+    int result = writeBlocks(disk, 0, nBlocks, image);
+    if (closeDisk(disk) != 0) {
+        return -1;
+    }
+    return result;
+}
+
+// write size bytes of data as file name and close it again
+static int storeFile(TinyFS *fs, char *name, char *data, int size) {
+    fileDescriptor fd = fs_openFile(fs, name);
+    if (fd < 0 || fs_writeFile(fs, fd, data, size) != 0) {
+        return -1;
+    }
+    return fs_closeFile(fs, fd);
+}
+
+// whether file name holds exactly size bytes of data (an empty file if it did not exist)
+static int fileHolds(TinyFS *fs, char *name, char *data, int size) {
+    char *back = malloc(size + 1);
+    fileDescriptor fd = fs_openFile(fs, name);
+    int holds = back != NULL && fd >= 0 && fs_readFile(fs, fd, back, size + 1) == size &&
+                memcmp(back, data, size) == 0;
+    if (fd >= 0) {
+        fs_closeFile(fs, fd);
+    }
+    free(back);
+    return holds;
+}
+
+static void fillPattern(char *data, int size, int seed) {
+    for (int i = 0; i < size; i++) {
+        data[i] = (char)(seed + i * 7 + i / 251);
+    }
+}
+
+#define JOURNAL_DISK_BLOCKS 128
+
+// a crash right after a commit whose in-place writes never reached the disk: the metadata
+// as before it, the journal and the file data (written during the calls) as after it
+static char *crashImage(char *before, char *after) {
+    char *crash = malloc((size_t)JOURNAL_DISK_BLOCKS * BLOCKSIZE);
+    if (crash == NULL) {
+        return NULL;
+    }
+    memcpy(crash, before, (size_t)JOURNAL_DISK_BLOCKS * BLOCKSIZE);
+    int header = 1 + getField(after, _BITMAP_BLOCKS);
+    int nJournal = getField(&after[header * BLOCKSIZE], _JOURNAL_BLOCKS);
+    for (int b = 0; b < JOURNAL_DISK_BLOCKS; b++) {
+        char *block = &after[(size_t)b * BLOCKSIZE];
+        if ((b >= header && b < header + nJournal) || block[_BLOCK_TYPE] == 3) {
+            memcpy(&crash[(size_t)b * BLOCKSIZE], block, BLOCKSIZE);
+        }
+    }
+    return crash;
+}
+
+// replay of a logged commit whose home writes were lost, a commit record with a bad checksum
+// ignored, and blocks freed since the last checkpoint kept out of new files until it
+static int journalTest(void) {
+    char *disk = "journal.dsk";
+    char keep[2 * BLOCKSIZE];
+    char added[3 * BLOCKSIZE];
+    fillPattern(keep, sizeof(keep), 1);
+    fillPattern(added, sizeof(added), 2);
+    tfs_configureJournal(JOURNAL_MIN_BLOCKS * 2);
+    int result = freshDisk(disk, JOURNAL_DISK_BLOCKS * BLOCKSIZE);
+    tfs_configureJournal(JOURNAL_AUTO);
+    TinyFS *fs = result == 0 ? fs_mount(disk) : NULL;
+    if (fs == NULL || storeFile(fs, "keep", keep, sizeof(keep)) != 0 || fs_unmount(fs) != 0) {
+        return -1;
+    }
+
+    // the images are taken after fs_sync logged the change, before unmount checkpoints it
+    char *before = readImage(disk, JOURNAL_DISK_BLOCKS);
+    fs = fs_mount(disk);
+    if (before == NULL || fs == NULL || storeFile(fs, "added", added, sizeof(added)) != 0 || fs_sync(fs) != 0) {
+        return -1;
+    }
+    char *after = readImage(disk, JOURNAL_DISK_BLOCKS);
+    char *crash = after != NULL ? crashImage(before, after) : NULL;
+    if (fs_unmount(fs) != 0 || crash == NULL) {
+        return -1;
+    }
+
+    // a damaged commit record ends the replay before it: "added" was never committed
+    int header = 1 + getField(crash, _BITMAP_BLOCKS);
+    int nJournal = getField(&crash[header * BLOCKSIZE], _JOURNAL_BLOCKS);
+    char *damaged = malloc((size_t)JOURNAL_DISK_BLOCKS * BLOCKSIZE);
+    if (damaged == NULL) {
+        return -1;
+    }
+    memcpy(damaged, crash, (size_t)JOURNAL_DISK_BLOCKS * BLOCKSIZE);
+    for (int b = header + 1; b < header + nJournal; b++) {
+        if (damaged[(size_t)b * BLOCKSIZE + _BLOCK_TYPE] == 10) {
+            damaged[(size_t)b * BLOCKSIZE + _RECORD_CHECKSUM] ^= 0x01;
+        }
+    }
+    if (writeImage(disk, JOURNAL_DISK_BLOCKS, damaged) != 0 || (fs = fs_mount(disk)) == NULL ||
+        !fileHolds(fs, "keep", keep, sizeof(keep)) || !fileHolds(fs, "added", "", 0) || fs_unmount(fs) != 0) {
+        return -1;
+    }
+
+    // the intact record is replayed at mount and brings the lost home writes back
+    if (writeImage(disk, JOURNAL_DISK_BLOCKS, crash) != 0 || (fs = fs_mount(disk)) == NULL ||
+        !fileHolds(fs, "keep", keep, sizeof(keep)) || !fileHolds(fs, "added", added, sizeof(added))) {
+        return -1;
+    }
+    free(before);
+    free(after);
+    free(crash);
+    free(damaged);
+
+    // until a checkpoint a replay could still put "added" back, so its blocks are not reused
+    if (fs_sync(fs) != 0 || (before = readImage(disk, JOURNAL_DISK_BLOCKS)) == NULL) {
+        return -1;
+    }
+    fileDescriptor fd = fs_openFile(fs, "added");
+    if (fd < 0 || fs_deleteFile(fs, fd) != 0 || storeFile(fs, "fresh", keep, sizeof(keep)) != 0 ||
+        storeFile(fs, "more", added, sizeof(added)) != 0 || fs_sync(fs) != 0 ||
+        (after = readImage(disk, JOURNAL_DISK_BLOCKS)) == NULL) {
+        return -1;
+    }
+    int reused = 0;
+    for (int b = 0; b < JOURNAL_DISK_BLOCKS; b++) {
+        char *block = &before[(size_t)b * BLOCKSIZE];
+        if (block[_BLOCK_TYPE] == 3 && memcmp(&block[4], added, 4) == 0 &&
+            memcmp(block, &after[(size_t)b * BLOCKSIZE], BLOCKSIZE) != 0) {
+            reused++;
+        }
+    }
+    free(before);
+    free(after);
+    if (reused > 0 || !fileHolds(fs, "fresh", keep, sizeof(keep)) || !fileHolds(fs, "more", added, sizeof(added))) {
+        return -1;
+    }
+    return fs_unmount(fs);
+}
+
+// CRC32C known answer, and the same sum whether a buffer is fed in one call or in small pieces
+static int crcTest(void) {
+    if (crc32c(0, "123456789", 9) != 0xE3069283u) {
+        return -1;
+    }
+    static char data[3 * 8192 + 13];
+    fillPattern(data, sizeof(data), 3);
+    unsigned int whole = crc32c(0, data, sizeof(data));
+    unsigned int pieces = 0;
+    for (size_t done = 0, n = 1; done < sizeof(data); done += n, n = n % 61 + 1) {
+        pieces = crc32c(pieces, &data[done], done + n < sizeof(data) ? n : sizeof(data) - done);
+    }
+    return whole == pieces ? 0 : -1;
+}
+
+#define SUMS_DISK_BLOCKS 64
+
+// first block of the image that is a data block starting with file data data, -1 if none
+static int findDataBlock(char *image, int nBlocks, char *data) {
+    for (int b = 0; b < nBlocks; b++) {
+        char *block = &image[(size_t)b * BLOCKSIZE];
+        if (block[_BLOCK_TYPE] == 3 && memcmp(&block[4], data, 16) == 0) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+// byte offset of the inode called name in the image, -1 if there is none
+static long findInode(char *image, int nBlocks, char *name) {
+    for (int b = 0; b < nBlocks; b++) {
+        for (int slot = 0; slot < INODES_PER_BLOCK; slot++) {
+            char *inode = &image[(size_t)b * BLOCKSIZE + slot * INODE_SIZE];
+            if (inode[_BLOCK_TYPE] == 2 && inode[_MAGIC_NUMBER] == 0x44 && strcmp(&inode[_NAME], name) == 0) {
+                return (long)b * BLOCKSIZE + slot * INODE_SIZE;
+            }
+        }
+    }
+    return -1;
+}
+
+// one byte flipped in a data block fails both reads of it, one flipped in an inode block fails the open
+static int checksumTest(void) {
+    char *disk = "sums.dsk";
+    char data[3 * BLOCKSIZE];
+    fillPattern(data, sizeof(data), 4);
+    tfs_configureChecksums(CHECKSUM_BLOCK);
+    int result = freshDisk(disk, SUMS_DISK_BLOCKS * BLOCKSIZE);
+    tfs_configureChecksums(CHECKSUM_NONE);
+    TinyFS *fs = result == 0 ? fs_mount(disk) : NULL;
+    if (fs == NULL || storeFile(fs, "data", data, sizeof(data)) != 0 || storeFile(fs, "small", "tiny", 5) != 0 ||
+        fs_unmount(fs) != 0) {
+        return -1;
+    }
+    char *image = readImage(disk, SUMS_DISK_BLOCKS);
+    if (image == NULL) {
+        return -1;
+    }
+    int dataBlock = findDataBlock(image, SUMS_DISK_BLOCKS, data);
+    long inode = findInode(image, SUMS_DISK_BLOCKS, "small");
+    if (dataBlock < 0 || inode < 0) {
+        free(image);
+        return -1;
+    }
+
+    image[(size_t)dataBlock * BLOCKSIZE + 4 + 10] ^= 0x01;
+    char byte;
+    fileDescriptor fd;
+    if (writeImage(disk, SUMS_DISK_BLOCKS, image) != 0 || (fs = fs_mount(disk)) == NULL ||
+        (fd = fs_openFile(fs, "data")) < 0 || fs_readFile(fs, fd, data, sizeof(data)) != TFS_ECHECKSUM ||
+        fs_seek(fs, fd, 10) != 0 || fs_readByte(fs, fd, &byte) != TFS_ECHECKSUM || fs_unmount(fs) != 0) {
+        free(image);
+        return -1;
+    }
+
+    image[(size_t)dataBlock * BLOCKSIZE + 4 + 10] ^= 0x01;
+    image[inode + _INLINE_DATA] ^= 0x01;
+    if (writeImage(disk, SUMS_DISK_BLOCKS, image) != 0 || (fs = fs_mount(disk)) == NULL ||
+        fs_openFile(fs, "small") != TFS_ECHECKSUM || fs_unmount(fs) != 0) {
+        free(image);
+        return -1;
+    }
+    free(image);
+    return 0;
+}
+
+// text-like data: words repeating at varying distances, the kind LZ compresses well
+static void fillText(char *data, int size) {
+    static const char *words[] = {"tiny ", "disk ", "block ", "inode ", "extent ", "journal ", "chunk "};
+    int pos = 0;
+    for (int i = 0; pos < size; i++) {
+        const char *word = words[(i * 5 + i / 13) % 7];
+        for (int j = 0; word[j] != '\0' && pos < size; j++) {
+            data[pos++] = word[j];
+        }
+    }
+}
+
+// data LZ cannot shrink
+static void fillNoise(char *data, int size) {
+    unsigned int x = 12345;
+    for (int i = 0; i < size; i++) {
+        x = x * 1103515245u + 12345u;
+        data[i] = (char)(x >> 16);
+    }
+}
+
+// the whole file through tfs_readFile, and single bytes on either side of every chunk boundary
+static int readsBack(TinyFS *fs, fileDescriptor fd, char *data, int size) {
+    char *back = malloc(size + 1);
+    if (back == NULL || fs_seek(fs, fd, 0) != 0 || fs_readFile(fs, fd, back, size + 1) != size ||
+        memcmp(back, data, size) != 0) {
+        free(back);
+        return 0;
+    }
+    free(back);
+    for (int boundary = 0; boundary <= size; boundary += COMPRESS_CHUNK) {
+        for (int offset = boundary - 1; offset <= boundary + 1; offset++) {
+            char byte;
+            if (offset < 0) {
+                continue;
+            }
+            int result = fs_seek(fs, fd, offset) == 0 ? fs_readByte(fs, fd, &byte) : -1;
+            if (offset < size ? result != 0 || byte != data[offset] : result != TFS_EEOF) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+#define COMPRESS_DISK_BYTES (8 * COMPRESS_CHUNK + 16 * BLOCKSIZE)
+
+// compression turned on and off over several chunks, data that does not shrink, and files
+// as large as the disk lets them be, compressed or not
+static int compressionTest(void) {
+    char *disk = "lz.dsk";
+    int textSize = 3 * COMPRESS_CHUNK + 123;
+    int noiseSize = 2 * COMPRESS_CHUNK + 7;
+    int bigSize = 2 * COMPRESS_DISK_BYTES;
+    char *text = malloc(bigSize);
+    char *noise = malloc(COMPRESS_DISK_BYTES);
+    TinyFS *fs = text != NULL && noise != NULL && freshDisk(disk, COMPRESS_DISK_BYTES) == 0 ? fs_mount(disk) : NULL;
+    if (fs == NULL) {
+        free(text);
+        free(noise);
+        return -1;
+    }
+    fillText(text, bigSize);
+    fillNoise(noise, COMPRESS_DISK_BYTES);
+
+    int ok = 1;
+    fileDescriptor fd = fs_openFile(fs, "text");
+    ok = ok && fd >= 0 && fs_writeFile(fs, fd, text, textSize) == 0 && readsBack(fs, fd, text, textSize);
+    ok = ok && fs_setCompression(fs, fd, COMPRESS_LZ) == 0 && readsBack(fs, fd, text, textSize);
+    ok = ok && fs_setCompression(fs, fd, COMPRESS_NONE) == 0 && readsBack(fs, fd, text, textSize);
+    ok = ok && fs_setCompression(fs, fd, COMPRESS_LZ) == 0 && fs_deleteFile(fs, fd) == 0;
+
+    fd = fs_openFile(fs, "noise");
+    ok = ok && fd >= 0 && fs_setCompression(fs, fd, COMPRESS_LZ) == 0 &&
+         fs_writeFile(fs, fd, noise, noiseSize) == 0 && readsBack(fs, fd, noise, noiseSize);
+    ok = ok && fs_unmount(fs) == 0 && (fs = fs_mount(disk)) != NULL;
+    ok = ok && (fd = fs_openFile(fs, "noise")) >= 0 && readsBack(fs, fd, noise, noiseSize);
+
+    // the disk bounds the stored bytes: text twice its size fits compressed but not plain,
+    // noise as large as the disk fits neither way, and a refused write keeps the old contents
+    fileDescriptor big = ok ? fs_openFile(fs, "big") : -1;
+    ok = ok && big >= 0 && fs_setCompression(fs, big, COMPRESS_LZ) == 0 &&
+         fs_writeFile(fs, big, text, bigSize) == 0 && readsBack(fs, big, text, bigSize);
+    ok = ok && fs_setCompression(fs, big, COMPRESS_NONE) == TFS_ENOSPC && readsBack(fs, big, text, bigSize);
+    ok = ok && fs_writeFile(fs, fd, noise, COMPRESS_DISK_BYTES) == TFS_ENOSPC && readsBack(fs, fd, noise, noiseSize);
+    ok = ok && fs_unmount(fs) == 0;
+    free(text);
+    free(noise);
+    return ok ? 0 : -1;
+}
+
+// free blocks the superblock records, once a sync has written the bitmap back
+static int freeBlocks(TinyFS *fs, char *disk) {
+    char *superblock = fs_sync(fs) == 0 ? readImage(disk, 1) : NULL;
+    if (superblock == NULL) {
+        return -1;
+    }
+    int nFree = getField(superblock, _NUM_FREE_BLOCKS);
+    free(superblock);
+    return nFree;
+}
+
+// size bytes of data through tfs_readFile, and through seek + readByte at both ends and the middle
+static int inlineReadsBack(TinyFS *fs, fileDescriptor fd, char *data, int size) {
+    char back[BLOCKSIZE];
+    if (fs_seek(fs, fd, 0) != 0 || fs_readFile(fs, fd, back, sizeof(back)) != size || memcmp(back, data, size) != 0) {
+        return 0;
+    }
+    int offsets[] = {0, size / 2, size - 1};
+    for (int i = 0; i < 3; i++) {
+        char byte;
+        if (fs_seek(fs, fd, offsets[i]) != 0 || fs_readByte(fs, fd, &byte) != 0 || byte != data[offsets[i]]) {
+            return 0;
+        }
+    }
+    char byte;
+    return fs_seek(fs, fd, size) == 0 && fs_readByte(fs, fd, &byte) == TFS_EEOF;
+}
+
+// a file of exactly the inline limit takes no data block, one byte more spills into one,
+// and shrinking back under the limit moves it inline again and frees that block
+static int inlineTest(void) {
+    char *disk = "inline.dsk";
+    int limit = INODE_SIZE - _INLINE_DATA;
+    char data[BLOCKSIZE];
+    fillPattern(data, sizeof(data), 5);
+    TinyFS *fs = freshDisk(disk, 64 * BLOCKSIZE) == 0 ? fs_mount(disk) : NULL;
+    fileDescriptor fd = fs != NULL ? fs_openFile(fs, "edge") : -1;
+    int nFree = fd >= 0 ? freeBlocks(fs, disk) : -1;
+    if (nFree < 0) {
+        return -1;
+    }
+    int ok = fs_writeFile(fs, fd, data, limit) == 0 && freeBlocks(fs, disk) == nFree &&
+             inlineReadsBack(fs, fd, data, limit);
+    ok = ok && fs_writeFile(fs, fd, data, limit + 1) == 0 && freeBlocks(fs, disk) == nFree - 1 &&
+         inlineReadsBack(fs, fd, data, limit + 1);
+    ok = ok && fs_writeFile(fs, fd, data, limit) == 0 && freeBlocks(fs, disk) == nFree &&
+         inlineReadsBack(fs, fd, data, limit);
+    ok = ok && fs_unmount(fs) == 0 && (fs = fs_mount(disk)) != NULL;
+    ok = ok && (fd = fs_openFile(fs, "edge")) >= 0 && inlineReadsBack(fs, fd, data, limit) && fs_unmount(fs) == 0;
+    return ok ? 0 : -1;
+}
+
+#define SLOTS_DISK_BLOCKS 64
+
+// blocks of the image with the given block type
+static int countBlocks(char *image, int nBlocks, int type) {
+    int count = 0;
+    for (int b = 0; b < nBlocks; b++) {
+        count += image[(size_t)b * BLOCKSIZE + _BLOCK_TYPE] == type;
+    }
+    return count;
+}
+
+// the inode map blocks of the image back to back, in a new buffer
+static char *inodeMapOf(char *image, int nBlocks, int *size) {
+    char *map = malloc((size_t)nBlocks * BLOCKSIZE);
+    *size = 0;
+    for (int b = 0; map != NULL && b < nBlocks; b++) {
+        if (image[(size_t)b * BLOCKSIZE + _BLOCK_TYPE] == 12) {
+            memcpy(&map[*size], &image[(size_t)b * BLOCKSIZE], BLOCKSIZE);
+            *size += BLOCKSIZE;
+        }
+    }
+    return map;
+}
+
+// the next inode goes in the slot a delete freed, an inode block whose last inode is
+// deleted is freed, and a directory rebuild at mount comes up with the same inode map
+static int inodeSlotTest(void) {
+    char *disk = "slots.dsk";
+    int nFiles = 2 * INODES_PER_BLOCK + 1;
+    char name[MAX_NAME_LENGTH + 1];
+    TinyFS *fs = freshDisk(disk, SLOTS_DISK_BLOCKS * BLOCKSIZE) == 0 ? fs_mount(disk) : NULL;
+    int ok = fs != NULL;
+    for (int i = 0; ok && i < nFiles; i++) {
+        snprintf(name, sizeof(name), "s%d", i);
+        ok = storeFile(fs, name, name, strlen(name)) == 0;
+    }
+    ok = ok && fs_unmount(fs) == 0;
+    char *image = ok ? readImage(disk, SLOTS_DISK_BLOCKS) : NULL;
+    if (image == NULL) {
+        return -1;
+    }
+    int inodeBlocks = countBlocks(image, SLOTS_DISK_BLOCKS, 2);
+    long freed = findInode(image, SLOTS_DISK_BLOCKS, "s1");
+    free(image);
+
+    // a slot freed in the middle of a block is taken before any new block
+    fileDescriptor fd;
+    ok = inodeBlocks == 3 && freed >= 0 && (fs = fs_mount(disk)) != NULL && (fd = fs_openFile(fs, "s1")) >= 0 &&
+         fs_deleteFile(fs, fd) == 0 && storeFile(fs, "reuse", "r", 1) == 0 && fs_unmount(fs) == 0;
+    image = ok ? readImage(disk, SLOTS_DISK_BLOCKS) : NULL;
+    if (image == NULL || findInode(image, SLOTS_DISK_BLOCKS, "reuse") != freed ||
+        countBlocks(image, SLOTS_DISK_BLOCKS, 2) != inodeBlocks) {
+        free(image);
+        return -1;
+    }
+
+    // deleting every inode in the block of the last file frees the block
+    snprintf(name, sizeof(name), "s%d", nFiles - 1);
+    int emptied = (int)(findInode(image, SLOTS_DISK_BLOCKS, name) / BLOCKSIZE);
+    fs = fs_mount(disk);
+    int nFree = fs != NULL ? freeBlocks(fs, disk) : -1;
+    for (int slot = 0; nFree >= 0 && slot < INODES_PER_BLOCK; slot++) {
+        char *inode = &image[(size_t)emptied * BLOCKSIZE + slot * INODE_SIZE];
+        if (inode[_NAME] != '\0' && ((fd = fs_openFile(fs, &inode[_NAME])) < 0 || fs_deleteFile(fs, fd) != 0)) {
+            nFree = -1;
+        }
+    }
+    free(image);
+    ok = nFree >= 0 && freeBlocks(fs, disk) == nFree + 1 && fs_unmount(fs) == 0;
+    image = ok ? readImage(disk, SLOTS_DISK_BLOCKS) : NULL;
+    if (image == NULL || image[(size_t)emptied * BLOCKSIZE + _BLOCK_TYPE] == 2 ||
+        countBlocks(image, SLOTS_DISK_BLOCKS, 2) != inodeBlocks - 1) {
+        free(image);
+        return -1;
+    }
+
+    // with the directory block damaged, mount rebuilds it and the inode map from the inode blocks
+    int mapSize;
+    int rebuiltSize;
+    char *map = inodeMapOf(image, SLOTS_DISK_BLOCKS, &mapSize);
+    image[(size_t)getField(image, _ROOT_INODE_BLOCK) * BLOCKSIZE + _BLOCK_TYPE] = 0;
+    ok = map != NULL && mapSize > 0 && writeImage(disk, SLOTS_DISK_BLOCKS, image) == 0 &&
+         (fs = fs_mount(disk)) != NULL && fileHolds(fs, "reuse", "r", 1) && fileHolds(fs, "s0", "s0", 2) &&
+         fs_unmount(fs) == 0;
+    free(image);
+    image = ok ? readImage(disk, SLOTS_DISK_BLOCKS) : NULL;
+    char *rebuilt = image != NULL ? inodeMapOf(image, SLOTS_DISK_BLOCKS, &rebuiltSize) : NULL;
+    ok = rebuilt != NULL && rebuiltSize == mapSize && memcmp(map, rebuilt, mapSize) == 0;
+    free(image);
+    free(map);
+    free(rebuilt);
+    return ok ? 0 : -1;
+}
+
+// a disk from before the inode map (version 8) keeps giving every inode a block of its own,
+// also after a write has moved its superblock to the current version
+static int oldInodeTest(void) {
+    char *disk = "old.dsk";
+    char *image = freshDisk(disk, SLOTS_DISK_BLOCKS * BLOCKSIZE) == 0 ? readImage(disk, SLOTS_DISK_BLOCKS) : NULL;
+    if (image == NULL) {
+        return -1;
+    }
+    // the same layout as version 8 made it: no inode map, the directory after the bitmap
+    image[_FS_VERSION] = 8;
+    for (int b = 1; b < SLOTS_DISK_BLOCKS; b++) {
+        char *block = &image[(size_t)b * BLOCKSIZE];
+        if (block[_BLOCK_TYPE] == 12) {
+            memset(block, 0, BLOCKSIZE);
+            block[_BLOCK_TYPE] = 4; // free block type
+            block[_MAGIC_NUMBER] = 0x44;
+            image[_BITMAP + b / 8] &= ~(1 << (b % 8));
+            setField(image, _NUM_FREE_BLOCKS, getField(image, _NUM_FREE_BLOCKS) + 1);
+        }
+    }
+    char name[MAX_NAME_LENGTH + 1];
+    TinyFS *fs = writeImage(disk, SLOTS_DISK_BLOCKS, image) == 0 ? fs_mount(disk) : NULL;
+    int ok = fs != NULL;
+    for (int i = 0; ok && i < 3; i++) {
+        snprintf(name, sizeof(name), "o%d", i);
+        ok = storeFile(fs, name, name, strlen(name)) == 0;
+    }
+    ok = ok && fs_unmount(fs) == 0;
+    free(image);
+    image = ok ? readImage(disk, SLOTS_DISK_BLOCKS) : NULL;
+    if (image == NULL || countBlocks(image, SLOTS_DISK_BLOCKS, 12) != 0 ||
+        countBlocks(image, SLOTS_DISK_BLOCKS, 2) != 3) {
+        free(image);
+        return -1;
+    }
+    for (int i = 0; i < 3; i++) {
+        snprintf(name, sizeof(name), "o%d", i);
+        if (findInode(image, SLOTS_DISK_BLOCKS, name) % BLOCKSIZE != 0) {
+            free(image);
+            return -1;
+        }
+    }
+    free(image);
+    fs = fs_mount(disk);
+    fileDescriptor fd;
+    ok = fs != NULL && fileHolds(fs, "o0", "o0", 2) && fileHolds(fs, "o2", "o2", 2) &&
+         (fd = fs_openFile(fs, "o1")) >= 0 && fs_deleteFile(fs, fd) == 0 && storeFile(fs, "o3", "o3", 2) == 0 &&
+         fs_unmount(fs) == 0;
+    image = ok ? readImage(disk, SLOTS_DISK_BLOCKS) : NULL;
+    ok = image != NULL && countBlocks(image, SLOTS_DISK_BLOCKS, 2) == 3 &&
+         findInode(image, SLOTS_DISK_BLOCKS, "o1") < 0 && findInode(image, SLOTS_DISK_BLOCKS, "o3") % BLOCKSIZE == 0;
+    free(image);
+    return ok ? 0 : -1;
+}
 
 int main() {
     char* filename = "tinyFSDisk"; // file name for the disk
@@ -93,6 +797,79 @@ int main() {
         return 1;
     }
 
+    // seeking before the start of a file is refused and leaves the file pointer alone
+    printf("\n\nSeeking before the start of a file...\n");
+    fd = tfs_openFile("t4.txt");
+    char bigdata[1000];
+    for (int i = 0; i < (int)sizeof(bigdata); i++) {
+        bigdata[i] = 'a' + i % 26;
+    }
+    char readback[100];
+    if (fd < 0 || tfs_writeFile(fd, bigdata, sizeof(bigdata)) != 0) {
+        printf("Failed to write data to the file.\n");
+        return 1;
+    }
+    if (tfs_seek(fd, -200) >= 0) {
+        printf("Negative seek was accepted.\n");
+        return 1;
+    }
+    result = tfs_readFile(fd, readback, sizeof(readback));
+    if (result != (int)sizeof(readback) || memcmp(readback, bigdata, sizeof(readback)) != 0) {
+        printf("Read after the negative seek did not start at the beginning of the file.\n");
+        return 1;
+    }
+    printf("Negative seek refused, read still starts at offset 0.\n");
+
+    printf("\n\nUsing one disk from several threads...\n");
+    if (threadTest() != 0) {
+        printf("Threads saw wrong data or a call failed.\n");
+        return 1;
+    }
+    printf("Threads done, every file holds what was last written to it.\n");
+
+    printf("\n\nReplaying the journal after a lost checkpoint...\n");
+    if (journalTest() != 0) {
+        printf("The journal did not bring back the committed change, or replayed a damaged one.\n");
+        return 1;
+    }
+    printf("Committed change replayed, damaged record ignored, freed blocks held until the checkpoint.\n");
+
+    printf("\n\nChecking block checksums...\n");
+    if (crcTest() != 0) {
+        printf("CRC32C gave the wrong answer.\n");
+        return 1;
+    }
+    if (checksumTest() != 0) {
+        printf("A damaged block was read without a checksum error.\n");
+        return 1;
+    }
+    printf("CRC32C matches its known answer, damaged data and inode blocks are refused.\n");
+
+    printf("\n\nCompressing a file and reading it back...\n");
+    if (compressionTest() != 0) {
+        printf("A compressed file read back wrong, or a size limit was not kept.\n");
+        return 1;
+    }
+    printf("Compressed and plain reads match, oversized writes are refused.\n");
+
+    printf("\n\nKeeping small files inline in their inode...\n");
+    if (inlineTest() != 0) {
+        printf("A file at the inline limit read back wrong or used the wrong number of blocks.\n");
+        return 1;
+    }
+    printf("Files up to the limit stay inline, one byte more takes a block, shrinking frees it.\n");
+
+    printf("\n\nPacking inodes into inode blocks...\n");
+    if (inodeSlotTest() != 0) {
+        printf("Inode slots were not reused or freed, or the rebuilt inode map differs.\n");
+        return 1;
+    }
+    if (oldInodeTest() != 0) {
+        printf("A disk without an inode map was not handled as one.\n");
+        return 1;
+    }
+    printf("Freed slots are reused, empty inode blocks freed, old disks keep an inode per block.\n");
+
     // write more data to first file
     // printf("\n\nWriting more data to first file...\n");
     // char moredata[] = "I love sleeping!";